@@ -21,13 +21,44 @@ dnl Check for new current_execute_data field in zend_executor_globals
   ], [static struct _zend_executor_globals zeg; zend_execute_data *zed = zeg.current_execute_data],
     [AC_DEFINE(HAVE_EXECUTE_DATA_PTR, 1, [ ])]
   )
-  AC_CHECK_FUNCS(gettimeofday)
+  AC_CHECK_FUNCS(gettimeofday posix_fallocate)
 
   PHP_CHECK_LIBRARY(m, cos, [ PHP_ADD_LIBRARY(m,, XDEBUG_SHARED_LIBADD) ])
 
+dnl clock_nanosleep() is used by the sampling profiler, older glibcs have it in librt
+  PHP_CHECK_LIBRARY(rt, clock_nanosleep, [
+    PHP_ADD_LIBRARY(rt,, XDEBUG_SHARED_LIBADD)
+    AC_DEFINE(HAVE_CLOCK_NANOSLEEP, 1, [ ])
+  ], [
+    AC_CHECK_FUNCS(clock_nanosleep)
+  ])
+
+dnl clock_gettime() is used for the monotonic clock, same story
+  PHP_CHECK_LIBRARY(rt, clock_gettime, [
+    PHP_ADD_LIBRARY(rt,, XDEBUG_SHARED_LIBADD)
+    AC_DEFINE(HAVE_CLOCK_GETTIME, 1, [ ])
+  ], [
+    AC_CHECK_FUNCS(clock_gettime)
+  ])
+
+dnl zlib is used for compressed profile and trace files, it is optional
+  PHP_CHECK_LIBRARY(z, deflateInit2_, [
+    AC_CHECK_HEADER(zlib.h, [
+      PHP_ADD_LIBRARY(z,, XDEBUG_SHARED_LIBADD)
+      AC_DEFINE(HAVE_XDEBUG_ZLIB, 1, [ ])
+    ])
+  ])
+
+dnl pthreads are used for the background output writer and the sampling
+dnl profiler's timer, they are optional
+  PHP_CHECK_LIBRARY(pthread, pthread_create, [
+    PHP_ADD_LIBRARY(pthread,, XDEBUG_SHARED_LIBADD)
+    AC_DEFINE(HAVE_XDEBUG_PTHREAD, 1, [ ])
+  ])
+
   CPPFLAGS=$old_CPPFLAGS
 
-  PHP_NEW_EXTENSION(xdebug, xdebug.c xdebug_code_coverage.c xdebug_com.c xdebug_compat.c xdebug_handler_dbgp.c xdebug_handlers.c xdebug_llist.c xdebug_hash.c xdebug_private.c xdebug_profiler.c xdebug_set.c xdebug_stack.c xdebug_str.c xdebug_superglobals.c xdebug_tracing.c xdebug_var.c xdebug_xml.c usefulstuff.c, $ext_shared,,,,yes)
+  PHP_NEW_EXTENSION(xdebug, xdebug.c xdebug_aggregate_shm.c xdebug_code_coverage.c xdebug_com.c xdebug_compat.c xdebug_file.c xdebug_handler_dbgp.c xdebug_handlers.c xdebug_llist.c xdebug_hash.c xdebug_private.c xdebug_profiler.c xdebug_set.c xdebug_stack.c xdebug_str.c xdebug_superglobals.c xdebug_tracing.c xdebug_var.c xdebug_xml.c usefulstuff.c, $ext_shared,,,,yes)
   PHP_SUBST(XDEBUG_SHARED_LIBADD)
   PHP_ADD_MAKEFILE_FRAGMENT
 fi
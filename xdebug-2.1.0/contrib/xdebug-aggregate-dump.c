@@ -0,0 +1,79 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2010 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.0 of the Xdebug license,    |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | http://xdebug.derickrethans.nl/license.php                           |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | xdebug@derickrethans.nl so we can mail you a copy immediately.       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@xdebug.org>                         |
+   +----------------------------------------------------------------------+
+ */
+
+/* Writes the shared aggregate profile (xdebug.profiler_aggregate_shm) as a
+ * cachegrind file, without going through PHP.
+ *
+ * Build with "make" in this directory, or:
+ *   cc -o xdebug-aggregate-dump xdebug-aggregate-dump.c ../xdebug_aggregate_shm.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../xdebug_aggregate_shm.h"
+
+static int dump_vprintf(void *out, const char *fmt, va_list args)
+{
+	return vfprintf((FILE *) out, fmt, args);
+}
+
+int main(int argc, char *argv[])
+{
+	xdebug_aggr_shm *shm;
+	FILE            *out = stdout;
+	int              clear = 0, ret;
+
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		clear = 1;
+		argc--;
+		argv++;
+	}
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: xdebug-aggregate-dump [-c] <shm file> [output file]\n");
+		fprintf(stderr, "  -c  clear the aggregate after writing it\n");
+		return 1;
+	}
+
+	shm = xdebug_aggr_shm_open(argv[1], 0, 0);
+	if (!shm) {
+		fprintf(stderr, "Can not map '%s' as an aggregate profile.\n", argv[1]);
+		return 1;
+	}
+
+	if (argc == 3) {
+		out = fopen(argv[2], "w");
+		if (!out) {
+			fprintf(stderr, "Can not open '%s' for writing.\n", argv[2]);
+			xdebug_aggr_shm_close(shm);
+			return 1;
+		}
+	}
+
+	ret = xdebug_aggr_shm_dump(shm, dump_vprintf, out);
+	if (ret == 0 && clear) {
+		xdebug_aggr_shm_clear(shm);
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	xdebug_aggr_shm_close(shm);
+
+	return ret == 0 ? 0 : 1;
+}
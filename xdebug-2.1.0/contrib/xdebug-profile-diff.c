@@ -0,0 +1,473 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2010 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.0 of the Xdebug license,    |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | http://xdebug.derickrethans.nl/license.php                           |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | xdebug@derickrethans.nl so we can mail you a copy immediately.       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@xdebug.org>                         |
+   +----------------------------------------------------------------------+
+ */
+
+/* Compares two (sets of) cachegrind files written by the profiler, and lists
+ * per function how the number of calls, and the inclusive and own time and
+ * memory changed. When a side has more than one file, the average over its
+ * files is used. Functions are matched on name, and records of the same
+ * function are added up, like KCachegrind does.
+ *
+ * The files are mapped rather than read, so that even files of several
+ * gigabytes are scanned in a few seconds.
+ *
+ * Build with "make" in this directory, or:
+ *   cc -O2 -o xdebug-profile-diff xdebug-profile-diff.c
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BEFORE 0
+#define AFTER  1
+
+#define SORT_CALLS      0
+#define SORT_TIME       1
+#define SORT_TIME_OWN   2
+#define SORT_MEMORY     3
+#define SORT_MEMORY_OWN 4
+
+typedef struct _profile_cost {
+	double calls;
+	double time;
+	double time_own;
+	double memory;
+	double memory_own;
+} profile_cost;
+
+typedef struct _profile_function {
+	char         *name;
+	size_t        name_len;
+	unsigned int  hash;
+	profile_cost  cost[2];
+} profile_function;
+
+/* All functions of both sides, with an open addressing hash on name */
+static profile_function *functions = NULL;
+static long              function_count = 0;
+static long              function_size = 0;
+static long             *function_hash = NULL;
+static long              function_hash_size = 0;
+
+static unsigned int hash_name(const char *name, size_t len)
+{
+	unsigned int h = 2166136261u;
+
+	while (len--) {
+		h = (h ^ (unsigned char) *name++) * 16777619u;
+	}
+	return h;
+}
+
+static void function_hash_grow(void)
+{
+	long i, j;
+
+	function_hash_size = function_hash_size ? function_hash_size * 2 : 4096;
+	free(function_hash);
+	function_hash = malloc(function_hash_size * sizeof(long));
+	for (i = 0; i < function_hash_size; i++) {
+		function_hash[i] = -1;
+	}
+	for (i = 0; i < function_count; i++) {
+		j = functions[i].hash & (function_hash_size - 1);
+		while (function_hash[j] != -1) {
+			j = (j + 1) & (function_hash_size - 1);
+		}
+		function_hash[j] = i;
+	}
+}
+
+static long function_get(const char *name, size_t len)
+{
+	unsigned int      h = hash_name(name, len);
+	long              j;
+	profile_function *f;
+
+	if (function_count * 2 >= function_hash_size) {
+		function_hash_grow();
+	}
+
+	j = h & (function_hash_size - 1);
+	while (function_hash[j] != -1) {
+		f = &functions[function_hash[j]];
+		if (f->hash == h && f->name_len == len && memcmp(f->name, name, len) == 0) {
+			return function_hash[j];
+		}
+		j = (j + 1) & (function_hash_size - 1);
+	}
+
+	if (function_count == function_size) {
+		function_size = function_size ? function_size * 2 : 1024;
+		functions = realloc(functions, function_size * sizeof(profile_function));
+	}
+	f = &functions[function_count];
+	memset(f, 0, sizeof(profile_function));
+	f->name = malloc(len + 1);
+	memcpy(f->name, name, len);
+	f->name[len] = '\0';
+	f->name_len = len;
+	f->hash = h;
+	function_hash[j] = function_count;
+
+	return function_count++;
+}
+
+/* The compressed names of one file: id -> function */
+typedef struct _name_table {
+	long *ids;
+	long  size;
+} name_table;
+
+static void name_table_set(name_table *table, long id, long function)
+{
+	long old = table->size;
+
+	if (id >= table->size) {
+		while (id >= table->size) {
+			table->size = table->size ? table->size * 2 : 1024;
+		}
+		table->ids = realloc(table->ids, table->size * sizeof(long));
+		while (old < table->size) {
+			table->ids[old++] = -1;
+		}
+	}
+	table->ids[id] = function;
+}
+
+/* Resolves the value of an fn= or cfn= line, which is "(id) name" the
+ * first time a compressed name is used, "(id)" after that, and just "name"
+ * in files without name compression */
+static long resolve_function(name_table *table, const char *p, const char *end)
+{
+	long id;
+
+	if (p < end && *p == '(') {
+		id = strtol(p + 1, NULL, 10);
+		while (p < end && *p != ')') {
+			p++;
+		}
+		p++;
+		while (p < end && *p == ' ') {
+			p++;
+		}
+		if (p >= end) {
+			return id >= 0 && id < table->size ? table->ids[id] : -1;
+		}
+		name_table_set(table, id, function_get(p, end - p));
+		return table->ids[id];
+	}
+	return function_get(p, end - p);
+}
+
+/* Parses a number, moving p past it */
+static double parse_number(const char **p, const char *end)
+{
+	const char *s = *p;
+	long long   v = 0;
+	int         negative = 0;
+
+	while (s < end && *s == ' ') {
+		s++;
+	}
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s == '-';
+		s++;
+	}
+	while (s < end && *s >= '0' && *s <= '9') {
+		v = v * 10 + (*s - '0');
+		s++;
+	}
+	*p = s;
+	return (double) (negative ? -v : v);
+}
+
+static int parse_file(const char *path, int side)
+{
+	struct stat  st;
+	const char  *map, *p, *end, *line_end, *value;
+	int          fd, i;
+	int          columns = 0, time_column = -1, memory_column = -1;
+	int          allocated_column = -1, freed_column = -1;
+	double       values[16], memory;
+	long         current = -1, callee = -1;
+	int          after_calls = 0;
+	name_table   names = { NULL, 0 };
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "Can not open '%s'.\n", path);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Can not map '%s'.\n", path);
+		return -1;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	p = map;
+	end = map + st.st_size;
+	while (p < end) {
+		line_end = memchr(p, '\n', end - p);
+		if (!line_end) {
+			line_end = end;
+		}
+
+		if ((*p >= '0' && *p <= '9') || *p == '+' || *p == '-') {
+			/* A cost line: position, then one value per event */
+			value = p;
+			parse_number(&value, line_end);
+			for (i = 0; i < columns && value < line_end; i++) {
+				values[i] = parse_number(&value, line_end);
+			}
+			while (i < columns) {
+				values[i++] = 0;
+			}
+
+			/* Current profiles split the net memory change in two unsigned
+			 * events, older ones have it signed in one */
+			memory = 0;
+			if (memory_column != -1) {
+				memory = values[memory_column];
+			} else if (allocated_column != -1 && freed_column != -1) {
+				memory = values[allocated_column] - values[freed_column];
+			}
+
+			if (after_calls) {
+				if (current != -1 && time_column != -1) {
+					functions[current].cost[side].time += values[time_column];
+				}
+				if (current != -1) {
+					functions[current].cost[side].memory += memory;
+				}
+				after_calls = 0;
+			} else if (current != -1) {
+				if (time_column != -1) {
+					functions[current].cost[side].time += values[time_column];
+					functions[current].cost[side].time_own += values[time_column];
+				}
+				functions[current].cost[side].memory += memory;
+				functions[current].cost[side].memory_own += memory;
+			}
+
+		} else if (strncmp(p, "fn=", 3) == 0) {
+			current = resolve_function(&names, p + 3, line_end);
+
+		} else if (strncmp(p, "cfn=", 4) == 0) {
+			callee = resolve_function(&names, p + 4, line_end);
+
+		} else if (strncmp(p, "calls=", 6) == 0) {
+			value = p + 6;
+			if (callee != -1) {
+				functions[callee].cost[side].calls += parse_number(&value, line_end);
+			}
+			after_calls = 1;
+
+		} else if (strncmp(p, "events:", 7) == 0) {
+			/* Every part of an appended file has its own header */
+			columns = 0;
+			time_column = memory_column = allocated_column = freed_column = -1;
+			value = p + 7;
+			while (value < line_end && columns < 16) {
+				while (value < line_end && *value == ' ') {
+					value++;
+				}
+				if (value >= line_end) {
+					break;
+				}
+				if (line_end - value >= 4 && strncmp(value, "Time", 4) == 0 && (value + 4 == line_end || value[4] == ' ')) {
+					time_column = columns;
+				} else if (line_end - value >= 6 && strncmp(value, "Memory", 6) == 0 && (value + 6 == line_end || value[6] == ' ')) {
+					memory_column = columns;
+				} else if (line_end - value >= 15 && strncmp(value, "MemoryAllocated", 15) == 0 && (value + 15 == line_end || value[15] == ' ')) {
+					allocated_column = columns;
+				} else if (line_end - value >= 11 && strncmp(value, "MemoryFreed", 11) == 0 && (value + 11 == line_end || value[11] == ' ')) {
+					freed_column = columns;
+				}
+				while (value < line_end && *value != ' ') {
+					value++;
+				}
+				columns++;
+			}
+			free(names.ids);
+			names.ids = NULL;
+			names.size = 0;
+			current = callee = -1;
+		}
+
+		p = line_end + 1;
+	}
+
+	free(names.ids);
+	munmap((void *) map, st.st_size);
+
+	return 0;
+}
+
+static int sort_key = SORT_TIME;
+
+static double cost_value(const profile_cost *cost)
+{
+	switch (sort_key) {
+		case SORT_CALLS:      return cost->calls;
+		case SORT_TIME_OWN:   return cost->time_own;
+		case SORT_MEMORY:     return cost->memory;
+		case SORT_MEMORY_OWN: return cost->memory_own;
+		default:              return cost->time;
+	}
+}
+
+/* Largest change first, whichever way it went */
+static int compare_delta(const void *a, const void *b)
+{
+	const profile_function *fa = (const profile_function *) a;
+	const profile_function *fb = (const profile_function *) b;
+	double da = cost_value(&fa->cost[AFTER]) - cost_value(&fa->cost[BEFORE]);
+	double db = cost_value(&fb->cost[AFTER]) - cost_value(&fb->cost[BEFORE]);
+
+	if (da < 0) {
+		da = -da;
+	}
+	if (db < 0) {
+		db = -db;
+	}
+	if (da != db) {
+		return da > db ? -1 : 1;
+	}
+	return strcmp(fa->name, fb->name);
+}
+
+static void scale(int side, int files)
+{
+	long i;
+
+	for (i = 0; i < function_count; i++) {
+		functions[i].cost[side].calls /= files;
+		functions[i].cost[side].time /= files;
+		functions[i].cost[side].time_own /= files;
+		functions[i].cost[side].memory /= files;
+		functions[i].cost[side].memory_own /= files;
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: xdebug-profile-diff [-n count] [-s key] <before> <after>\n");
+	fprintf(stderr, "       xdebug-profile-diff [-n count] [-s key] <before>... -- <after>...\n");
+	fprintf(stderr, "  -n  only list the count functions that changed most\n");
+	fprintf(stderr, "  -s  sort on calls, time (the default), time_own, memory or memory_own\n");
+}
+
+int main(int argc, char *argv[])
+{
+	long  limit = 0, i;
+	int   separator = 0, files[2] = { 0, 0 }, side, arg;
+	char *key;
+
+	while (argc > 2 && argv[1][0] == '-' && argv[1][1] != '-') {
+		if (strcmp(argv[1], "-n") == 0) {
+			limit = atol(argv[2]);
+		} else if (strcmp(argv[1], "-s") == 0) {
+			key = argv[2];
+			if (strcmp(key, "calls") == 0) {
+				sort_key = SORT_CALLS;
+			} else if (strcmp(key, "time") == 0) {
+				sort_key = SORT_TIME;
+			} else if (strcmp(key, "time_own") == 0) {
+				sort_key = SORT_TIME_OWN;
+			} else if (strcmp(key, "memory") == 0) {
+				sort_key = SORT_MEMORY;
+			} else if (strcmp(key, "memory_own") == 0) {
+				sort_key = SORT_MEMORY_OWN;
+			} else {
+				usage();
+				return 1;
+			}
+		} else {
+			usage();
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	for (arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "--") == 0) {
+			separator = arg;
+		}
+	}
+	if (separator ? (separator == 1 || separator == argc - 1) : argc != 3) {
+		usage();
+		return 1;
+	}
+
+	for (arg = 1; arg < argc; arg++) {
+		if (arg == separator) {
+			continue;
+		}
+		side = separator ? (arg > separator ? AFTER : BEFORE) : (arg == 2 ? AFTER : BEFORE);
+		if (parse_file(argv[arg], side) != 0) {
+			return 1;
+		}
+		files[side]++;
+	}
+	scale(BEFORE, files[BEFORE]);
+	scale(AFTER, files[AFTER]);
+
+	qsort(functions, function_count, sizeof(profile_function), compare_delta);
+	if (limit <= 0 || limit > function_count) {
+		limit = function_count;
+	}
+
+	printf("%-60s %12s %14s %8s %14s %14s %14s\n", "function", "calls", "time", "%", "time own", "memory", "memory own");
+	for (i = 0; i < limit; i++) {
+		profile_cost *b = &functions[i].cost[BEFORE];
+		profile_cost *a = &functions[i].cost[AFTER];
+		char          percent[16];
+
+		if (b->time) {
+			snprintf(percent, sizeof(percent), "%+.1f", (a->time - b->time) * 100 / b->time);
+		} else {
+			snprintf(percent, sizeof(percent), "%s", a->time ? "new" : "");
+		}
+		printf(
+			"%-60s %+12.0f %+14.0f %8s %+14.0f %+14.0f %+14.0f\n",
+			functions[i].name,
+			a->calls - b->calls,
+			a->time - b->time,
+			percent,
+			a->time_own - b->time_own,
+			a->memory - b->memory,
+			a->memory_own - b->memory_own
+		);
+	}
+
+	return 0;
+}
@@ -29,9 +29,11 @@
 
 #include "php.h"
 
+#include "xdebug_file.h"
 #include "xdebug_handlers.h"
 #include "xdebug_hash.h"
 #include "xdebug_llist.h"
+#include "usefulstuff.h"
 
 extern zend_module_entry xdebug_module_entry;
 #define phpext_xdebug_ptr &xdebug_module_entry
@@ -118,6 +120,11 @@ PHP_FUNCTION(xdebug_get_collected_errors);
 
 /* profiling functions */
 PHP_FUNCTION(xdebug_get_profiler_filename);
+PHP_FUNCTION(xdebug_get_profile_summary);
+PHP_FUNCTION(xdebug_get_profile_files);
+PHP_FUNCTION(xdebug_get_profile_categories);
+PHP_FUNCTION(xdebug_get_profile_sql);
+PHP_FUNCTION(xdebug_get_repeated_queries);
 PHP_FUNCTION(xdebug_dump_aggr_profiling_data);
 PHP_FUNCTION(xdebug_clear_aggr_profiling_data);
 
@@ -148,7 +155,7 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	zend_bool     show_local_vars;
 	zend_bool     show_mem_delta;
 	char         *manual_url;
-	double        start_time;
+	xdebug_nanotime start_time;
 	HashTable    *active_symbol_table;
 	zend_execute_data *active_execute_data;
 	zend_op_array     *active_op_array;
@@ -161,13 +168,14 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	void        (*orig_var_dump_func)(INTERNAL_FUNCTION_PARAMETERS);
 	void        (*orig_set_time_limit_func)(INTERNAL_FUNCTION_PARAMETERS);
 
-	FILE         *trace_file;
+	xdebug_file  *trace_file;
 	zend_bool     do_trace;
 	zend_bool     auto_trace;
 	char         *trace_output_dir;
 	char         *trace_output_name;
 	long          trace_options;
 	long          trace_format;
+	long          trace_sample_rate;
 	char         *tracefile_name;
 	char         *last_exception_trace;
 	char         *last_eval_statement;
@@ -233,11 +241,77 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 	char         *profiler_output_name; /* "pid" or "crc32" */
 	zend_bool     profiler_enable_trigger;
 	zend_bool     profiler_append;
+	long          profiler_buffer_size;
+	zend_bool     output_mmap;
+	long          output_compression; /* XDEBUG_FILE_OPT_GZIP* */
+	long          output_async;       /* XDEBUG_FILE_OPT_ASYNC* */
+	long          profiler_max_output;
+	long          profiler_max_overhead;
+	zend_bool     profiler_cpu_time;
+	char         *profiler_include;
+	char         *profiler_exclude;
+	char         *profiler_lines; /* functions to cost per line; never closures or lambdas */
+	char         *profiler_categories;
+	zend_bool     profiler_sql;
+	char         *profiler_query_functions;
+	long          profiler_repeat_threshold;
+	char         *lightweight_internal; /* "*", or a list of function names */
+	long          profiler_mode;
+	long          profiler_sample_rate;
+	long          profiler_sample_interval; /* in microseconds */
+
+	/* request sampling */
+	char         *sample_header;
+	zend_bool     sample_decided;
+	zend_bool     profiler_sample_hit;
 
 	/* profiler globals */
 	zend_bool     profiler_enabled;
-	FILE         *profile_file;
+	zend_bool     profiler_sampling;
+	volatile long profile_samples_pending;
+	long          profile_sample_interval;
+	xdebug_file  *profile_file;
 	char         *profile_filename;
+	HashTable    *profile_filenames;
+	HashTable    *profile_function_names;
+	HashTable    *profile_function_cache;
+	HashTable    *profile_edges;
+	struct _xdebug_profiler_function **profile_functions;
+	long          profile_function_count;
+	long          profile_function_size;
+	struct _xdebug_profiler_stack_node *profile_stack_nodes;
+	long          profile_stack_node_count;
+	long          profile_stack_node_size;
+	HashTable    *profile_stack_children;
+	HashTable    *profile_sql; /* normalized statement -> xdebug_profiler_sql* */
+	HashTable    *profile_sql_cache; /* statement as run -> xdebug_profiler_sql* */
+	HashTable    *profile_repeats; /* statement and call site -> xdebug_profiler_repeat */
+	struct _xdebug_profiler_filter *profile_query_functions;
+	struct _xdebug_profiler_call_block *profile_call_blocks;
+	int           profile_call_block_used;
+	struct _xdebug_call_entry *profile_call_free;
+	long          profile_last_filename_ref;
+	long          profile_mode; /* profiler_mode, until the budget runs out */
+	zend_bool     profile_budget; /* whether a limit is set at all */
+	xdebug_nanotime profile_start_time;
+	xdebug_nanotime profile_script_compile_time; /* of the script that starts the profiler, which is compiled before it does */
+	xdebug_nanotime profile_overhead; /* time spent writing the timed records */
+	unsigned long profile_overhead_samples; /* records timed */
+	unsigned long profile_records; /* records written */
+	long          profile_budget_countdown; /* records until the next one timed */
+	struct _xdebug_profiler_filter *profile_include;
+	struct _xdebug_profiler_filter *profile_exclude;
+	struct _xdebug_profiler_filter *profile_lines;
+	int           profile_autoload_depth;
+	struct _xdebug_profiler_file *profile_autoload_file; /* first file the innermost autoload compiled */
+	struct _xdebug_profiler_category *profile_categories;
+	int           profile_category_count;
+	int           profile_category_depth; /* nesting of calls that have a category */
+
+	/* internal functions that run without a stack frame */
+	zend_bool     lightweight_all;
+	HashTable    *lightweight_names;
+	HashTable    *lightweight_cache; /* zend_function* -> whether it is lightweight */
 
 	/* DBGp globals */
 	char         *lastcmd;
@@ -251,7 +325,10 @@ ZEND_BEGIN_MODULE_GLOBALS(xdebug)
 
 	/* aggregate profiling */
 	HashTable  aggr_calls;
+	HashTable *aggr_sites;
 	zend_bool  profiler_aggregate;
+	char      *profiler_aggregate_shm;
+	long       profiler_aggregate_shm_size;
 
 	/* scream */
 	zend_bool  do_scream;
@@ -262,6 +339,9 @@ ZEND_END_MODULE_GLOBALS(xdebug)
 #else
 #define XG(v) (xdebug_globals.v)
 #endif
+
+/* The xdebug_file_open() options for profile and trace files */
+#define XDEBUG_OUTPUT_OPTIONS() ((XG(output_mmap) ? XDEBUG_FILE_OPT_MMAP : 0) | XG(output_compression) | XG(output_async))
 	
 #endif
 
@@ -0,0 +1,57 @@
+--TEST--
+Test for xdebug.profiler_mode=merged writing one record per function
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=merged
+xdebug.profiler_output_dir=/tmp
+xdebug.profiler_output_name=xdebug-profiler-merged-001.out
+--FILE--
+<?php
+function show()
+{
+	$file = xdebug_get_profiler_filename();
+	foreach (file($file, FILE_IGNORE_NEW_LINES) as $line) {
+		if (preg_match('/^(fl|fn|cfn|calls|summary)[=:]/', $line)) {
+			echo $line, "\n";
+		}
+	}
+	unlink($file);
+}
+
+function foo()
+{
+}
+
+function bar()
+{
+	for ($i = 0; $i < 2; $i++) {
+		foo();
+	}
+}
+
+for ($i = 0; $i < 2; $i++) {
+	bar();
+}
+
+/* exit() finishes the profile, so that show() can read it */
+register_shutdown_function('show');
+exit();
+?>
+--EXPECTF--
+fl=(1) %sprofiler_merged-001.php
+fn=(1) {main}
+summary: %d %d %d %d
+cfn=(2) bar
+calls=2 0 0
+cfn=(4) php::register_shutdown_function
+calls=1 0 0
+fl=(1)
+fn=(2)
+cfn=(3) foo
+calls=4 0 0
+fl=(1)
+fn=(3)
+fl=(2) php:internal
+fn=(4)
@@ -0,0 +1,40 @@
+--TEST--
+Test for xdebug.lightweight_internal=* not applying to Xdebug's own functions
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=0
+xdebug.collect_vars=1
+xdebug.lightweight_internal=*
+--FILE--
+<?php
+function caller()
+{
+	return xdebug_call_function();
+}
+
+function callee()
+{
+	return caller();
+}
+
+echo callee(), "\n";
+
+$a = 1;
+$b = 2;
+var_dump(is_array(xdebug_get_declared_vars()));
+
+function locals()
+{
+	$c = 3;
+	return xdebug_get_declared_vars();
+}
+var_dump(locals());
+?>
+--EXPECT--
+callee
+bool(true)
+array(1) {
+  [0]=>
+  string(1) "c"
+}
@@ -0,0 +1,29 @@
+--TEST--
+Test for xdebug_get_profile_categories() with the default categories
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=memory
+--FILE--
+<?php
+usleep(2000);
+file_exists(__FILE__);
+filesize(__FILE__);
+strlen('not in any category');
+
+foreach (xdebug_get_profile_categories() as $name => $category) {
+	printf("%s: calls=%d", $name, $category['calls']);
+	if ($name == 'sleep') {
+		printf(" at least 2ms=%s", $category['time'] >= 0.002 ? 'yes' : 'no');
+	}
+	echo "\n";
+}
+?>
+--EXPECT--
+db: calls=0
+file: calls=2
+session: calls=0
+lock: calls=0
+network: calls=0
+sleep: calls=1 at least 2ms=yes
@@ -0,0 +1,31 @@
+--TEST--
+Test for xdebug_get_profile_files()
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=memory
+--FILE--
+<?php
+$inc = dirname(__FILE__) . '/profiler_files-001.inc';
+file_put_contents($inc, "<?php\n\$x = 1;\n");
+
+include $inc;
+include $inc;
+
+foreach (xdebug_get_profile_files() as $name => $file) {
+	printf(
+		"%s: compiles=%d includes=%d size=%s compile_time=%s\n",
+		basename($name), $file['compiles'], $file['includes'],
+		$file['size'] == filesize($name) ? 'ok' : $file['size'],
+		$file['compile_time'] > 0 ? 'yes' : 'no'
+	);
+}
+echo implode(', ', array_keys($file)), "\n";
+
+unlink($inc);
+?>
+--EXPECT--
+profiler_files-001.php: compiles=1 includes=0 size=ok compile_time=yes
+profiler_files-001.inc: compiles=2 includes=2 size=ok compile_time=yes
+compile_time, execute_time, autoload_time, size, compiles, includes
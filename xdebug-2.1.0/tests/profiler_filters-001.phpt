@@ -0,0 +1,45 @@
+--TEST--
+Test for xdebug.profiler_include and xdebug.profiler_exclude
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=memory
+xdebug.profiler_include=work,helper_*
+xdebug.profiler_exclude=helper_b
+--FILE--
+<?php
+function helper_a()
+{
+	return strlen('x');
+}
+
+function helper_b()
+{
+}
+
+function other()
+{
+}
+
+function work()
+{
+	helper_a();
+	helper_b();
+	other();
+}
+
+work();
+work();
+other();
+
+$names = array();
+foreach (xdebug_get_profile_summary() as $entry) {
+	$names[] = $entry['function'] . ' ' . $entry['calls'];
+}
+sort($names);
+echo implode("\n", $names), "\n";
+?>
+--EXPECT--
+helper_a 2
+work 2
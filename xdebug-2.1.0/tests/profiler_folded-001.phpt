@@ -0,0 +1,42 @@
+--TEST--
+Test for xdebug.profiler_mode=folded
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=folded
+xdebug.profiler_output_dir=/tmp
+xdebug.profiler_output_name=xdebug-profiler-folded-001.out
+--FILE--
+<?php
+function show()
+{
+	$file = xdebug_get_profiler_filename();
+	foreach (file($file, FILE_IGNORE_NEW_LINES) as $line) {
+		echo preg_replace('/ [0-9]+$/', ' N', $line), "\n";
+	}
+	unlink($file);
+}
+
+function foo()
+{
+	return strlen('x');
+}
+
+function bar()
+{
+	foo();
+}
+
+bar();
+
+/* exit() finishes the profile, so that show() can read it */
+register_shutdown_function('show');
+exit();
+?>
+--EXPECT--
+{main} N
+{main};bar N
+{main};bar;foo N
+{main};bar;foo;strlen N
+{main};register_shutdown_function N
@@ -0,0 +1,68 @@
+--TEST--
+Test for xdebug.profiler_lines costing a function's lines
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.extended_info=1
+xdebug.profiler_enable=1
+xdebug.profiler_mode=merged
+xdebug.profiler_lines=work
+xdebug.profiler_output_dir=/tmp
+xdebug.profiler_output_name=xdebug-profiler-lines-001.out
+--FILE--
+<?php
+function show()
+{
+	$file = xdebug_get_profiler_filename();
+	$names = array();
+	$record = $callee = null;
+	$lines = array();
+	foreach (file($file, FILE_IGNORE_NEW_LINES) as $line) {
+		if ($line == 'positions: line') {
+			echo $line, "\n";
+		} else if (preg_match('/^(c?fn)=\((\d+)\)(?: (.*))?$/', $line, $m)) {
+			/* Names are only written the first time */
+			if (isset($m[3])) {
+				$names[$m[2]] = $m[3];
+			}
+			if ($m[1] == 'fn') {
+				$record = $names[$m[2]];
+				$callee = null;
+			} else {
+				$callee = $names[$m[2]];
+			}
+		} else if ($record == 'work' && preg_match('/^([0-9]+) [0-9]+ [0-9]+ [0-9]+ [0-9]+$/', $line, $m)) {
+			if ($callee) {
+				echo "call to $callee on line ", $m[1] - WORK_LINE, "\n";
+			} else {
+				$lines[$m[1] - WORK_LINE] = true;
+			}
+		}
+	}
+	/* Each line has its own cost, and the rest goes on the first line */
+	foreach (array(0, 2, 3) as $lineno) {
+		echo "line $lineno: ", isset($lines[$lineno]) ? 'yes' : 'no', "\n";
+	}
+	unlink($file);
+}
+
+define('WORK_LINE', __LINE__ + 1);
+function work()
+{
+	usleep(1000);
+	$a = str_repeat('x', 10);
+}
+
+work();
+
+/* exit() finishes the profile, so that show() can read it */
+register_shutdown_function('show');
+exit();
+?>
+--EXPECT--
+positions: line
+call to php::usleep on line 2
+call to php::str_repeat on line 3
+line 0: yes
+line 2: yes
+line 3: yes
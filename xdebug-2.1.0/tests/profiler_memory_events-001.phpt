@@ -0,0 +1,52 @@
+--TEST--
+Test for the memory events in cachegrind profiles
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_output_dir=/tmp
+xdebug.profiler_output_name=xdebug-profiler-memory-events-001.out
+--FILE--
+<?php
+function show()
+{
+	$file = xdebug_get_profiler_filename();
+	$lines = file($file, FILE_IGNORE_NEW_LINES);
+	unlink($file);
+
+	foreach ($lines as $i => $line) {
+		if (strncmp($line, 'events: ', 8) == 0) {
+			echo $line, "\n";
+		}
+		/* Each record's own cost directly follows its name */
+		if (preg_match('/^fn=\(\d+\) (php::str_repeat|release)$/', $line, $m)) {
+			list($lineno, $time, $allocated, $freed, $peak) = explode(' ', $lines[$i + 1]);
+			printf(
+				"%s: allocated %s, freed %s\n", $m[1],
+				$allocated >= 100000 ? 'yes' : 'no', $freed >= 100000 ? 'yes' : 'no'
+			);
+		}
+	}
+}
+
+function alloc()
+{
+	return str_repeat('x', 100000);
+}
+
+function release(&$s)
+{
+	$s = null;
+}
+
+$keep = alloc();
+release($keep);
+
+/* exit() finishes the profile, so that show() can read it */
+register_shutdown_function('show');
+exit();
+?>
+--EXPECT--
+events: Time MemoryAllocated MemoryFreed PeakMemory
+php::str_repeat: allocated yes, freed no
+release: allocated no, freed yes
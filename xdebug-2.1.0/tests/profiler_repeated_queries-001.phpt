@@ -0,0 +1,47 @@
+--TEST--
+Test for xdebug_get_repeated_queries() and the repeated query log
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=memory
+xdebug.profiler_repeat_threshold=3
+xdebug.profiler_query_functions=strlen
+date.timezone=UTC
+--FILE--
+<?php
+function show_log()
+{
+	global $log;
+	echo preg_replace('/^\[[^\]]*\] /m', '', file_get_contents($log));
+	unlink($log);
+}
+
+/* strlen() stands in for a query function, so no database is needed */
+function find($id)
+{
+	return strlen("SELECT * FROM users WHERE id = $id");
+}
+
+for ($i = 1; $i <= 5; $i++) {
+	find($i);
+}
+strlen("SELECT 1");
+strlen("SELECT 2");
+
+foreach (xdebug_get_repeated_queries() as $query) {
+	printf(
+		"%s:%d in %s: %d times %s\n",
+		basename($query['file']), $query['line'], $query['function'], $query['count'], $query['sql']
+	);
+}
+
+/* exit() finishes the profile, which logs the repeats */
+$log = tempnam(sys_get_temp_dir(), 'xdebug');
+ini_set('error_log', $log);
+register_shutdown_function('show_log');
+exit();
+?>
+--EXPECTF--
+profiler_repeated_queries-001.php:12 in find: 5 times SELECT * FROM users WHERE id = ?
+Xdebug: the same query ran 5 times from %sprofiler_repeated_queries-001.php:12 in find, taking %f seconds: SELECT * FROM users WHERE id = ?
@@ -0,0 +1,33 @@
+--TEST--
+Test for xdebug_get_profile_sql() normalizing statements
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=memory
+xdebug.profiler_sql=1
+xdebug.profiler_query_functions=strlen
+--FILE--
+<?php
+/* strlen() stands in for a query function, so no database is needed */
+function query($sql)
+{
+	return strlen($sql);
+}
+
+query("SELECT * FROM t WHERE id = 1");
+query("SELECT * FROM t WHERE id = 22");
+query("SELECT  *  FROM t\n WHERE name = 'o''brien' AND id IN (1, 2, 3)");
+query("SELECT  *  FROM t\n WHERE name = 'smith' AND id IN (4)");
+
+$sql = xdebug_get_profile_sql();
+ksort($sql);
+foreach ($sql as $statement => $entry) {
+	echo $entry['count'], ' ', $statement, "\n";
+}
+echo implode(', ', array_keys($entry)), "\n";
+?>
+--EXPECT--
+2 SELECT * FROM t WHERE id = ?
+2 SELECT * FROM t WHERE name = ? AND id IN (?)
+count, time, max_time
@@ -0,0 +1,41 @@
+--TEST--
+Test for xdebug_get_profile_summary() with xdebug.profiler_mode=memory
+--INI--
+xdebug.default_enable=1
+xdebug.auto_trace=0
+xdebug.profiler_enable=1
+xdebug.profiler_mode=memory
+--FILE--
+<?php
+function foo()
+{
+}
+
+function bar()
+{
+	foo();
+	foo();
+}
+
+bar();
+bar();
+
+/* Nothing is written in this mode */
+var_dump(xdebug_get_profiler_filename());
+
+/* The internal functions called once, var_dump() included, come after */
+$summary = xdebug_get_profile_summary(2, 'calls');
+foreach ($summary as $entry) {
+	echo $entry['function'], ' ', basename($entry['file']), ':', $entry['line'], ' ', $entry['calls'], "\n";
+}
+echo implode(', ', array_keys($summary[0])), "\n";
+var_dump(count(xdebug_get_profile_summary(1)));
+var_dump(@xdebug_get_profile_summary(0, 'size'));
+?>
+--EXPECT--
+bool(false)
+foo profiler_summary-001.php:2 4
+bar profiler_summary-001.php:6 2
+function, file, line, calls, time, time_own, memory, memory_own
+int(1)
+bool(false)
@@ -18,11 +18,15 @@
 
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #ifndef WIN32
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/resource.h>
 #include <sys/file.h>
 #else
@@ -189,6 +193,53 @@ double xdebug_get_utime(void)
 	return 0;
 }
 
+/* A monotonic clock in nanoseconds, for measuring durations. It has no
+ * relation to the wall clock, use xdebug_get_utime() for that. */
+xdebug_nanotime xdebug_get_nanotime(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (xdebug_nanotime) ts.tv_sec * NANOS_IN_SEC + ts.tv_nsec;
+	}
+#elif defined(PHP_WIN32)
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER        counter;
+
+	if (!frequency.QuadPart) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	if (frequency.QuadPart && QueryPerformanceCounter(&counter)) {
+		return (xdebug_nanotime) (counter.QuadPart / frequency.QuadPart) * NANOS_IN_SEC +
+			(xdebug_nanotime) (counter.QuadPart % frequency.QuadPart) * NANOS_IN_SEC / frequency.QuadPart;
+	}
+#endif
+	return (xdebug_nanotime) (xdebug_get_utime() * NANOS_IN_SEC);
+}
+
+/* The CPU time used by the calling thread in nanoseconds, or 0 when the
+ * system can't tell */
+xdebug_nanotime xdebug_get_thread_cputime(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		return (xdebug_nanotime) ts.tv_sec * NANOS_IN_SEC + ts.tv_nsec;
+	}
+#elif defined(PHP_WIN32)
+	FILETIME creation, exit, kernel, user;
+
+	/* In units of 100 nanoseconds */
+	if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		return (((xdebug_nanotime) kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+			((xdebug_nanotime) user.dwHighDateTime << 32 | user.dwLowDateTime)) * 100;
+	}
+#endif
+	return 0;
+}
+
 char* xdebug_get_time(void)
 {
 	time_t cur_time;
@@ -432,7 +483,8 @@ FILE *xdebug_fopen(char *fname, char *mode, char *extension, char **new_fname)
 		return xdebug_open_file(fname, mode, extension, new_fname);
 	}
 
-	/* In write mode however we do have to do some stuff. */
+	/* In write mode ("w", or "w+" for read/write) however we do have to do
+	 * some stuff. */
 	/* 1. Check if the file exists */
 	if (extension) {
 		tmp_fname = xdebug_sprintf("%s.%s", fname, extension);
@@ -444,7 +496,7 @@ FILE *xdebug_fopen(char *fname, char *mode, char *extension, char **new_fname)
 
 	if (r == -1) {
 		/* 2. Cool, the file doesn't exist so we can open it without probs now. */
-		fh = xdebug_open_file(fname, "w", extension, new_fname);
+		fh = xdebug_open_file(fname, mode, extension, new_fname);
 		goto lock;
 	}
 
@@ -452,7 +504,7 @@ FILE *xdebug_fopen(char *fname, char *mode, char *extension, char **new_fname)
 	fh = xdebug_open_file(fname, "r+", extension, new_fname);
 	if (!fh) {
 		/* 4. If fh == null we couldn't even open the file, so open a new one with a new name */
-		fh = xdebug_open_file_with_random_ext(fname, "w", extension, new_fname);
+		fh = xdebug_open_file_with_random_ext(fname, mode, extension, new_fname);
 		goto lock;
 	}
 
@@ -462,13 +514,13 @@ FILE *xdebug_fopen(char *fname, char *mode, char *extension, char **new_fname)
 		if (errno == EWOULDBLOCK) {
 			fclose(fh);
 			/* 6. The file is in use, so we open one with a new name. */
-			fh = xdebug_open_file_with_random_ext(fname, "w", extension, new_fname);
+			fh = xdebug_open_file_with_random_ext(fname, mode, extension, new_fname);
 			goto lock;
 		}
 	}
 
 	/* 7. We established a lock, now we truncate and return the handle */
-	fh = freopen(tmp_fname, "w", fh);
+	fh = freopen(tmp_fname, mode, fh);
 
 lock: /* Yes yes, an evil goto label here!!! */
 	if (fh) {
@@ -19,6 +19,20 @@
 #ifndef __HAVE_USEFULSTUFF_H__
 #define __HAVE_USEFULSTUFF_H__
 
+#ifdef PHP_WIN32
+typedef unsigned __int64 xdebug_nanotime;
+#else
+# include <stdint.h>
+typedef uint64_t xdebug_nanotime;
+#endif
+
+#define NANOS_IN_SEC   1000000000
+#define NANOS_IN_MICRO 1000
+
+/* Converts a difference between two xdebug_get_nanotime() values */
+#define XDEBUG_NANOTIME_TO_SECONDS(t) ((double) (t) / NANOS_IN_SEC)
+#define XDEBUG_NANOTIME_TO_MICROS(t)  ((unsigned long) ((t) / NANOS_IN_MICRO))
+
 #define FD_RL_FILE    0
 #define FD_RL_SOCKET  1
 
@@ -56,6 +70,8 @@ char *xdebug_join(char *delim, xdebug_arg *args, int begin, int end);
 void xdebug_explode(char *delim, char *str, xdebug_arg *args, int limit);
 char* xdebug_memnstr(char *haystack, char *needle, int needle_len, char *end);
 double xdebug_get_utime(void);
+xdebug_nanotime xdebug_get_nanotime(void);
+xdebug_nanotime xdebug_get_thread_cputime(void);
 char* xdebug_get_time(void);
 char *xdebug_path_to_url(const char *fileurl TSRMLS_DC);
 char *xdebug_path_from_url(const char *fileurl TSRMLS_DC);
@@ -45,6 +45,7 @@
 #include "ext/standard/php_string.h"
 #include "php_globals.h"
 #include "ext/standard/php_var.h"
+#include "ext/standard/php_lcg.h"
 
 
 #include "php_xdebug.h"
@@ -112,6 +113,11 @@ zend_function_entry xdebug_functions[] = {
 	PHP_FE(xdebug_get_profiler_filename, NULL)
 	PHP_FE(xdebug_dump_aggr_profiling_data, NULL)
 	PHP_FE(xdebug_clear_aggr_profiling_data, NULL)
+	PHP_FE(xdebug_get_profile_summary,   NULL)
+	PHP_FE(xdebug_get_profile_files,     NULL)
+	PHP_FE(xdebug_get_profile_categories, NULL)
+	PHP_FE(xdebug_get_profile_sql,        NULL)
+	PHP_FE(xdebug_get_repeated_queries,   NULL)
 
 #if HAVE_PHP_MEMORY_USAGE
 	PHP_FE(xdebug_memory_usage,          NULL)
@@ -227,6 +233,54 @@ static PHP_INI_MH(OnUpdateDebugMode)
 	return SUCCESS;
 }
 
+static PHP_INI_MH(OnUpdateProfilerMode)
+{
+	if (new_value && strcmp(new_value, "merged") == 0) {
+		XG(profiler_mode) = XDEBUG_PROFILER_MODE_MERGED;
+
+	} else if (new_value && strcmp(new_value, "sample") == 0) {
+		XG(profiler_mode) = XDEBUG_PROFILER_MODE_SAMPLE;
+
+	} else if (new_value && strcmp(new_value, "memory") == 0) {
+		XG(profiler_mode) = XDEBUG_PROFILER_MODE_MEMORY;
+
+	} else if (new_value && strcmp(new_value, "folded") == 0) {
+		XG(profiler_mode) = XDEBUG_PROFILER_MODE_FOLDED;
+
+	} else {
+		XG(profiler_mode) = XDEBUG_PROFILER_MODE_FULL;
+	}
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateOutputAsync)
+{
+	if (new_value && strcmp(new_value, "block") == 0) {
+		XG(output_async) = XDEBUG_FILE_OPT_ASYNC;
+
+	} else if (new_value && strcmp(new_value, "drop") == 0) {
+		XG(output_async) = XDEBUG_FILE_OPT_ASYNC_DROP;
+
+	} else {
+		XG(output_async) = 0;
+	}
+	return SUCCESS;
+}
+
+static PHP_INI_MH(OnUpdateOutputCompression)
+{
+	if (new_value && strcmp(new_value, "gzip") == 0) {
+		XG(output_compression) = XDEBUG_FILE_OPT_GZIP;
+
+	} else if (new_value && strcmp(new_value, "fast") == 0) {
+		XG(output_compression) = XDEBUG_FILE_OPT_GZIP_FAST;
+
+	} else {
+		XG(output_compression) = 0;
+	}
+	return SUCCESS;
+}
+
 #ifdef P_tmpdir
 # define XDEBUG_TEMP_DIR P_tmpdir
 #else
@@ -240,6 +294,8 @@ PHP_INI_BEGIN()
 	STD_PHP_INI_ENTRY("xdebug.trace_output_name", "trace.%c",           PHP_INI_ALL,    OnUpdateString, trace_output_name, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.trace_format",      "0",                  PHP_INI_ALL,    OnUpdateLong,   trace_format,      zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.trace_options",     "0",                  PHP_INI_ALL,    OnUpdateLong,   trace_options,     zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.trace_sample_rate", "1",                  PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateLong, trace_sample_rate, zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.sample_header",     "",                   PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, sample_header, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.collect_includes","1",                  PHP_INI_ALL,    OnUpdateBool,   collect_includes,  zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_ENTRY("xdebug.collect_params",  "0",                    PHP_INI_ALL,    OnUpdateLong,   collect_params,    zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.collect_return",  "0",                  PHP_INI_ALL,    OnUpdateBool,   collect_return,    zend_xdebug_globals, xdebug_globals)
@@ -275,6 +331,26 @@ PHP_INI_BEGIN()
 	STD_PHP_INI_BOOLEAN("xdebug.profiler_enable_trigger", "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   profiler_enable_trigger, zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.profiler_append",         "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   profiler_append,         zend_xdebug_globals, xdebug_globals)
 	STD_PHP_INI_BOOLEAN("xdebug.profiler_aggregate",      "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   profiler_aggregate,      zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_aggregate_shm",    "",       PHP_INI_SYSTEM,                OnUpdateString, profiler_aggregate_shm,  zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_aggregate_shm_size", "65536", PHP_INI_SYSTEM,               OnUpdateLong,   profiler_aggregate_shm_size, zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_buffer_size",      "262144", PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateLong,   profiler_buffer_size,    zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_max_output",       "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateLong,   profiler_max_output,     zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_max_overhead",     "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateLong,   profiler_max_overhead,   zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_BOOLEAN("xdebug.profiler_cpu_time",       "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   profiler_cpu_time,       zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_include",          "",       PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, profiler_include,        zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.lightweight_internal",      "",       PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, lightweight_internal,    zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_exclude",          "",       PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, profiler_exclude,        zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_lines",            "",       PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, profiler_lines,          zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_categories",       XDEBUG_PROFILER_DEFAULT_CATEGORIES, PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, profiler_categories, zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_BOOLEAN("xdebug.profiler_sql",            "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   profiler_sql,            zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_query_functions",  "mysql_query,mysql_unbuffered_query,mysqli_query,mysqli_real_query,mysqli::query,mysqli::real_query", PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateString, profiler_query_functions, zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_repeat_threshold", "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateLong,   profiler_repeat_threshold, zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_BOOLEAN("xdebug.output_mmap",             "0",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   output_mmap,             zend_xdebug_globals, xdebug_globals)
+	PHP_INI_ENTRY("xdebug.output_compression",            "none",   PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateOutputCompression)
+	PHP_INI_ENTRY("xdebug.output_async",                  "none",   PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateOutputAsync)
+	PHP_INI_ENTRY("xdebug.profiler_mode",                 "full",   PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateProfilerMode)
+	STD_PHP_INI_ENTRY("xdebug.profiler_sample_rate",      "1",      PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateLong,   profiler_sample_rate,    zend_xdebug_globals, xdebug_globals)
+	STD_PHP_INI_ENTRY("xdebug.profiler_sample_interval",  "10000",  PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateLong,   profiler_sample_interval, zend_xdebug_globals, xdebug_globals)
 
 	/* Remote debugger settings */
 	STD_PHP_INI_BOOLEAN("xdebug.remote_enable",   "0",   PHP_INI_SYSTEM|PHP_INI_PERDIR, OnUpdateBool,   remote_enable,     zend_xdebug_globals, xdebug_globals)
@@ -489,6 +565,12 @@ PHP_MINIT_FUNCTION(xdebug)
 	/* initialize aggregate call information hash */
 	zend_hash_init_ex(&XG(aggr_calls), 50, NULL, (dtor_func_t) xdebug_profile_aggr_call_entry_dtor, 1, 0);
 
+	/* Map the shared aggregate before a process manager forks its workers, so
+	 * that they all inherit the same mapping */
+	if (XG(profiler_aggregate) && XG(profiler_aggregate_shm) && *XG(profiler_aggregate_shm) && XG(profiler_aggregate_shm_size) > 0) {
+		xdebug_aggr_shared = xdebug_aggr_shm_open(XG(profiler_aggregate_shm), XG(profiler_aggregate_shm_size), 1);
+	}
+
 	/* Redirect compile and execute functions to our own */
 	old_compile_file = zend_compile_file;
 	zend_compile_file = xdebug_compile_file;
@@ -507,7 +589,7 @@ PHP_MINIT_FUNCTION(xdebug)
 	zend_xdebug_global_offset = zend_get_resource_handle(&dummy_ext);
 
 	/* Overload the "exit" opcode */
-	XDEBUG_SET_OPCODE_OVERRIDE_COMMON(ZEND_EXIT);
+	zend_set_user_opcode_handler(ZEND_EXIT, xdebug_exit_handler);
 	XDEBUG_SET_OPCODE_OVERRIDE_COMMON(ZEND_JMP);
 	XDEBUG_SET_OPCODE_OVERRIDE_COMMON(ZEND_JMPZ);
 	XDEBUG_SET_OPCODE_OVERRIDE_COMMON(ZEND_JMPNZ);
@@ -596,7 +678,12 @@ PHP_MINIT_FUNCTION(xdebug)
 
 PHP_MSHUTDOWN_FUNCTION(xdebug)
 {
-	if (XG(profiler_aggregate)) {
+	/* The shared aggregate outlives this process, so it is left alone; use
+	 * xdebug_dump_aggr_profiling_data() or the xdebug-aggregate-dump tool */
+	if (xdebug_aggr_shared) {
+		xdebug_aggr_shm_close(xdebug_aggr_shared);
+		xdebug_aggr_shared = NULL;
+	} else if (XG(profiler_aggregate)) {
 		xdebug_profiler_output_aggr_data(NULL TSRMLS_CC);
 	}
 
@@ -608,6 +695,10 @@ PHP_MSHUTDOWN_FUNCTION(xdebug)
 
 	zend_hash_destroy(&XG(aggr_calls));
 
+	/* All files were closed at the end of their request, so there is
+	 * nothing left for the writer to do */
+	xdebug_file_writer_stop();
+
 #ifdef ZTS
 	ts_free_id(xdebug_globals_id);
 #else
@@ -671,9 +762,8 @@ static void xdebug_stack_element_dtor(void *dummy, void *elem)
 			e->used_vars = NULL;
 		}
 
-		if (e->profile.call_list) {
-			xdebug_llist_destroy(e->profile.call_list, NULL);
-			e->profile.call_list = NULL;
+		if (e->profile.line_times) {
+			xdfree(e->profile.line_times);
 		}
 
 		xdfree(e);
@@ -688,6 +778,97 @@ static void xdebug_stack_element_dtor(void *dummy, void *elem)
 #define COOKIE_ENCODE
 #endif
 
+/* xdebug.lightweight_internal lists the internal functions that are run
+ * without a stack frame: they only add to the function count, and their
+ * time is part of their caller's. "*" means all internal functions. */
+static void xdebug_lightweight_init(TSRMLS_D)
+{
+	char *list = XG(lightweight_internal), *start, *name;
+	int   dummy = 1;
+
+	XG(lightweight_all) = 0;
+	XG(lightweight_names) = NULL;
+	XG(lightweight_cache) = NULL;
+
+	if (!list || !*list) {
+		return;
+	}
+	if (strcmp(list, "*") == 0) {
+		XG(lightweight_all) = 1;
+		return;
+	}
+
+	XG(lightweight_names) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(lightweight_names), 32, NULL, NULL, 1);
+	while (*list) {
+		while (*list == ' ' || *list == ',') {
+			list++;
+		}
+		start = list;
+		while (*list && *list != ',' && *list != ' ') {
+			list++;
+		}
+		if (list > start) {
+			name = zend_str_tolower_dup(start, list - start);
+			zend_hash_add(XG(lightweight_names), name, list - start + 1, (void *) &dummy, sizeof(int), NULL);
+			efree(name);
+		}
+	}
+}
+
+static void xdebug_lightweight_deinit(TSRMLS_D)
+{
+	if (XG(lightweight_names)) {
+		zend_hash_destroy(XG(lightweight_names));
+		xdfree(XG(lightweight_names));
+		XG(lightweight_names) = NULL;
+	}
+	if (XG(lightweight_cache)) {
+		zend_hash_destroy(XG(lightweight_cache));
+		xdfree(XG(lightweight_cache));
+		XG(lightweight_cache) = NULL;
+	}
+}
+
+/* Whether an internal function can run without a frame. Methods only do
+ * with "*", and functions the profiler's include rules ask for never do.
+ * Xdebug's own functions never do either, as several of them look at their
+ * own frame on top of the stack. The answer is cached by function pointer,
+ * which relies on only internal functions ever being passed in: unlike user
+ * functions, they are not freed, and their addresses reused, mid-request. */
+static int xdebug_is_lightweight(zend_function *zf TSRMLS_DC)
+{
+	int   *cached, lightweight = 0;
+	char  *name;
+	size_t len;
+
+	if (XG(lightweight_cache) && zend_hash_index_find(XG(lightweight_cache), (ulong) zf, (void **) &cached) == SUCCESS) {
+		return *cached;
+	}
+
+	if (zf && zf->common.function_name && zf->internal_function.module != &xdebug_module_entry) {
+		if (XG(lightweight_all)) {
+			lightweight = 1;
+		} else if (!zf->common.scope) {
+			len = strlen(zf->common.function_name);
+			name = zend_str_tolower_dup(zf->common.function_name, len);
+			lightweight = zend_hash_exists(XG(lightweight_names), name, len + 1);
+			efree(name);
+		}
+		if (lightweight && XG(profiler_enabled) && xdebug_profiler_includes_internal(zf TSRMLS_CC)) {
+			lightweight = 0;
+		}
+	}
+
+	if (!XG(lightweight_cache)) {
+		XG(lightweight_cache) = xdmalloc(sizeof(HashTable));
+		zend_hash_init(XG(lightweight_cache), 64, NULL, NULL, 1);
+	}
+	zend_hash_index_update(XG(lightweight_cache), (ulong) zf, (void *) &lightweight, sizeof(int), NULL);
+
+	return lightweight;
+}
+
 PHP_RINIT_FUNCTION(xdebug)
 {
 	zend_function *orig;
@@ -709,6 +890,11 @@ PHP_RINIT_FUNCTION(xdebug)
 	XG(tracefile_name) = NULL;
 	XG(profile_file)  = NULL;
 	XG(profile_filename) = NULL;
+	XG(profile_filenames) = NULL;
+	XG(profile_samples_pending) = 0;
+	XG(profile_script_compile_time) = 0;
+	XG(aggr_sites)    = NULL;
+	xdebug_lightweight_init(TSRMLS_C);
 	XG(prev_memory)   = 0;
 	XG(function_count) = -1;
 	XG(active_symbol_table) = NULL;
@@ -770,12 +956,10 @@ PHP_RINIT_FUNCTION(xdebug)
 	}
 	XG(remote_enabled) = 0;
 	XG(profiler_enabled) = 0;
+	XG(profiler_sampling) = 0;
 	XG(breakpoints_allowed) = 1;
-	if (XG(auto_trace) && XG(trace_output_dir) && strlen(XG(trace_output_dir))) {
-		/* In case we do an auto-trace we are not interested in the return
-		 * value, but we still have to free it. */
-		xdfree(xdebug_start_trace(NULL, XG(trace_options) TSRMLS_CC));
-	}
+	XG(sample_decided) = 0;
+	XG(profiler_sample_hit) = 0;
 
 	/* Initialize some debugger context properties */
 	XG(context).program_name   = NULL;
@@ -790,7 +974,7 @@ PHP_RINIT_FUNCTION(xdebug)
 	XG(dumped) = 0;
 
 	/* Initialize start time */
-	XG(start_time) = xdebug_get_utime();
+	XG(start_time) = xdebug_get_nanotime();
 
 	/* Override var_dump with our own function */
 	XG(var_dump_overloaded) = 0;
@@ -827,15 +1011,27 @@ ZEND_MODULE_POST_ZEND_DEACTIVATE_D(xdebug)
 		xdfree(XG(context).program_name);
 	}
 
+	if (XG(profiler_sampling)) {
+		xdebug_profiler_sample_stop(TSRMLS_C);
+	}
+
 	xdebug_llist_destroy(XG(stack), NULL);
 	XG(stack) = NULL;
 
+	if (XG(aggr_sites)) {
+		zend_hash_destroy(XG(aggr_sites));
+		xdfree(XG(aggr_sites));
+		XG(aggr_sites) = NULL;
+	}
+	xdebug_lightweight_deinit(TSRMLS_C);
+
 	if (XG(do_trace) && XG(trace_file)) {
 		xdebug_stop_trace(TSRMLS_C);
 	}
 
-	if (XG(profile_file)) {
-		fclose(XG(profile_file));
+	/* In memory-only mode there is no file, but the tables still exist */
+	if (XG(profile_filenames)) {
+		xdebug_profiler_close_file(TSRMLS_C);
 	}
 
 	if (XG(profile_filename)) {
@@ -1064,6 +1260,36 @@ static int handle_breakpoints(function_stack_entry *fse, int breakpoint_type)
 	return 1;
 }
 
+/* A rate of N selects one in every N requests */
+#define XDEBUG_SAMPLE_HIT(value, rate) ((rate) <= 1 || ((value) % (unsigned long) (rate)) == 0)
+
+/* Returns the value that the sample rates are applied to. When
+ * xdebug.sample_header names a request header that is present, this is a
+ * hash of its value, so that every request that carries the same value
+ * (such as a request ID that is passed on between services) gets the same
+ * decision. Otherwise it is random. */
+static unsigned long xdebug_request_sample_value(TSRMLS_D)
+{
+	char  *server_key, *p;
+	zval **header;
+	int    found;
+
+	if (XG(sample_header) && *XG(sample_header) && PG(http_globals)[TRACK_VARS_SERVER]) {
+		server_key = xdebug_sprintf("HTTP_%s", XG(sample_header));
+		for (p = server_key; *p; p++) {
+			*p = (*p == '-') ? '_' : toupper(*p);
+		}
+		found = zend_hash_find(Z_ARRVAL_P(PG(http_globals)[TRACK_VARS_SERVER]), server_key, strlen(server_key) + 1, (void **) &header) == SUCCESS;
+		xdfree(server_key);
+
+		if (found && Z_TYPE_PP(header) == IS_STRING) {
+			return (unsigned long) xdebug_crc32(Z_STRVAL_PP(header), Z_STRLEN_PP(header));
+		}
+	}
+
+	return (unsigned long) (php_combined_lcg(TSRMLS_C) * 0x7FFFFFFF);
+}
+
 void xdebug_execute(zend_op_array *op_array TSRMLS_DC)
 {
 	zval                **dummy;
@@ -1092,6 +1318,24 @@ void xdebug_execute(zend_op_array *op_array TSRMLS_DC)
 	}
 
 	if (XG(level) == 0) {
+		/* Decide once per request whether the profiler and the tracer are
+		 * enabled by their sample rates */
+		if (!XG(sample_decided)) {
+			unsigned long sample_value = xdebug_request_sample_value(TSRMLS_C);
+
+			XG(sample_decided) = 1;
+			XG(profiler_sample_hit) = XDEBUG_SAMPLE_HIT(sample_value, XG(profiler_sample_rate));
+
+			if (
+				XG(auto_trace) && XG(trace_output_dir) && strlen(XG(trace_output_dir)) &&
+				XDEBUG_SAMPLE_HIT(sample_value, XG(trace_sample_rate))
+			) {
+				/* In case we do an auto-trace we are not interested in the return
+				 * value, but we still have to free it. */
+				xdfree(xdebug_start_trace(NULL, XG(trace_options) TSRMLS_CC));
+			}
+		}
+
 		/* Set session cookie if requested */
 		if (
 			((
@@ -1191,9 +1435,9 @@ void xdebug_execute(zend_op_array *op_array TSRMLS_DC)
 
 		/* Check for special GET/POST parameter to start profiling */
 		if (
-			!XG(profiler_enabled) &&
+			!XG(profiler_enabled) && !XG(profiler_sampling) &&
 			(
-				XG(profiler_enable)
+				(XG(profiler_enable) && XG(profiler_sample_hit))
 				|| 
 				(
 					XG(profiler_enable_trigger) &&
@@ -1213,11 +1457,23 @@ void xdebug_execute(zend_op_array *op_array TSRMLS_DC)
 			)
 		) {
 			if (xdebug_profiler_init(op_array->filename TSRMLS_CC) == SUCCESS) {
-				XG(profiler_enabled) = 1;
+				if (XG(profiler_mode) != XDEBUG_PROFILER_MODE_SAMPLE) {
+					XG(profiler_enabled) = 1;
+					xdebug_profiler_compiled(op_array, XG(profile_script_compile_time) TSRMLS_CC);
+				} else if (xdebug_profiler_sample_start(TSRMLS_C) == SUCCESS) {
+					XG(profiler_sampling) = 1;
+				} else {
+					/* Instrumenting every call instead would cost what the
+					 * sampling mode was picked to avoid */
+					php_log_err("Xdebug: could not start the sampling profiler's timer, profiling is disabled for this request" TSRMLS_CC);
+					xdebug_profiler_close_file(TSRMLS_C);
+				}
 			}
 		}
 	}
 
+	XDEBUG_PROFILER_SAMPLE_CHECK();
+
 	XG(level)++;
 	if (XG(level) == XG(max_nesting_level)) {
 		php_error(E_ERROR, "Maximum function nesting level of '%ld' reached, aborting!", XG(max_nesting_level));
@@ -1274,6 +1530,7 @@ void xdebug_execute(zend_op_array *op_array TSRMLS_DC)
 	if (XG(profiler_enabled)) {
 		xdebug_profiler_function_user_end(fse, op_array TSRMLS_CC);
 	}
+	XDEBUG_PROFILER_SAMPLE_CHECK();
 
 	xdebug_trace_function_end(fse, function_nr TSRMLS_CC);
 
@@ -1281,8 +1538,8 @@ void xdebug_execute(zend_op_array *op_array TSRMLS_DC)
 	if (XG(collect_return) && do_return && XG(do_trace) && XG(trace_file)) {
 		if (EG(return_value_ptr_ptr) && *EG(return_value_ptr_ptr)) {
 			char* t = xdebug_return_trace_stack_retval(fse, *EG(return_value_ptr_ptr) TSRMLS_CC);
-			fprintf(XG(trace_file), "%s", t);
-			fflush(XG(trace_file));
+			xdebug_file_write(XG(trace_file), t, strlen(t));
+			xdebug_file_flush(XG(trace_file));
 			xdfree(t);
 		}
 	}
@@ -1313,6 +1570,26 @@ void xdebug_execute_internal(zend_execute_data *current_execute_data, int return
 	int                   do_return = (XG(do_trace) && XG(trace_file));
 	int                   function_nr = 0;
 
+	XDEBUG_PROFILER_SAMPLE_CHECK();
+
+	/* Lightweight functions don't get a frame, unless a trace or a debugging
+	 * session, with its breakpoints, needs to see them */
+	if (
+		(XG(lightweight_all) || XG(lightweight_names)) &&
+		!(XG(do_trace) && XG(trace_file)) &&
+		!(XG(remote_enabled) && XG(breakpoints_allowed)) &&
+		xdebug_is_lightweight(edata->function_state.function TSRMLS_CC)
+	) {
+		XG(function_count)++;
+		if (xdebug_old_execute_internal) {
+			xdebug_old_execute_internal(current_execute_data, return_value_used TSRMLS_CC);
+		} else {
+			execute_internal(current_execute_data, return_value_used TSRMLS_CC);
+		}
+		XDEBUG_PROFILER_SAMPLE_CHECK();
+		return;
+	}
+
 	XG(level)++;
 	if (XG(level) == XG(max_nesting_level)) {
 		php_error(E_ERROR, "Maximum function nesting level of '%ld' reached, aborting!", XG(max_nesting_level));
@@ -1342,6 +1619,7 @@ void xdebug_execute_internal(zend_execute_data *current_execute_data, int return
 	if (XG(profiler_enabled)) {
 		xdebug_profiler_function_internal_end(fse TSRMLS_CC);
 	}
+	XDEBUG_PROFILER_SAMPLE_CHECK();
 
 	xdebug_trace_function_end(fse, function_nr TSRMLS_CC);
 
@@ -1351,8 +1629,8 @@ void xdebug_execute_internal(zend_execute_data *current_execute_data, int return
 		if (cur_opcode) {
 			zval *ret = xdebug_zval_ptr(&(cur_opcode->result), current_execute_data->Ts TSRMLS_CC);
 			char* t = xdebug_return_trace_stack_retval(fse, ret TSRMLS_CC);
-			fprintf(XG(trace_file), "%s", t);
-			fflush(XG(trace_file));
+			xdebug_file_write(XG(trace_file), t, strlen(t));
+			xdebug_file_flush(XG(trace_file));
 			xdfree(t);
 		}
 	}
@@ -1368,14 +1646,23 @@ void xdebug_execute_internal(zend_execute_data *current_execute_data, int return
 	XG(level)--;
 }
 
-/* Opcode handler for exit, to be able to clean up the profiler */
+/* Opcode handler for exit, to be able to clean up the profiler. The script
+ * does not return through xdebug_execute() after this, so this is the last
+ * chance to write out the frames that are still on the stack. {main} is
+ * among them, so the profile is finished here: shutdown functions and
+ * destructors that run after exit() are not profiled. */
 int xdebug_exit_handler(ZEND_OPCODE_HANDLER_ARGS)
 {
 	if (XG(profiler_enabled)) {
 		xdebug_profiler_deinit(TSRMLS_C);
+		xdebug_profiler_close_file(TSRMLS_C);
+		XG(profiler_enabled) = 0;
+	}
+	if (XG(profiler_sampling)) {
+		xdebug_profiler_sample_stop(TSRMLS_C);
 	}
 	
-	return ZEND_USER_OPCODE_DISPATCH;
+	return xdebug_common_override_handler(ZEND_OPCODE_HANDLER_ARGS_PASSTHRU);
 }
 
 
@@ -1384,8 +1671,21 @@ int xdebug_exit_handler(ZEND_OPCODE_HANDLER_ARGS)
 zend_op_array *xdebug_compile_file(zend_file_handle *file_handle, int type TSRMLS_DC)
 {
 	zend_op_array *op_array;
+	xdebug_nanotime start;
 	
-	op_array = old_compile_file(file_handle, type TSRMLS_CC);
+	if (XG(profiler_enabled)) {
+		start = xdebug_get_nanotime();
+		op_array = old_compile_file(file_handle, type TSRMLS_CC);
+		xdebug_profiler_compiled(op_array, xdebug_get_nanotime() - start TSRMLS_CC);
+	} else if (XG(level) == 0 && (XG(profiler_enable) || XG(profiler_enable_trigger))) {
+		/* A script that is compiled outside of any function is about to be
+		 * run by xdebug_execute(), which may start the profiler */
+		start = xdebug_get_nanotime();
+		op_array = old_compile_file(file_handle, type TSRMLS_CC);
+		XG(profile_script_compile_time) = xdebug_get_nanotime() - start;
+	} else {
+		op_array = old_compile_file(file_handle, type TSRMLS_CC);
+	}
 
 	if (op_array) {
 		if (XG(do_code_coverage) && XG(code_coverage_unused && op_array->done_pass_two)) {
@@ -1634,6 +1934,102 @@ PHP_FUNCTION(xdebug_get_profiler_filename)
 	}
 }
 
+/* {{{ proto array xdebug_get_profile_summary([int limit [, string sort_key]])
+   Returns the per function totals of the running profile, sorted on "time",
+   "time_own", "memory", "memory_own" or "calls", largest first. Only
+   available with xdebug.profiler_mode set to "merged" or "memory". */
+PHP_FUNCTION(xdebug_get_profile_summary)
+{
+	long  limit = 0;
+	char *sort_key = NULL;
+	int   sort_key_len = 0;
+	int   sort = XDEBUG_PROFILER_SORT_TIME;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|ls", &limit, &sort_key, &sort_key_len) == FAILURE) {
+		return;
+	}
+
+	if (sort_key) {
+		if (strcmp(sort_key, "time") == 0) {
+			sort = XDEBUG_PROFILER_SORT_TIME;
+		} else if (strcmp(sort_key, "time_own") == 0) {
+			sort = XDEBUG_PROFILER_SORT_TIME_OWN;
+		} else if (strcmp(sort_key, "memory") == 0) {
+			sort = XDEBUG_PROFILER_SORT_MEMORY;
+		} else if (strcmp(sort_key, "memory_own") == 0) {
+			sort = XDEBUG_PROFILER_SORT_MEMORY_OWN;
+		} else if (strcmp(sort_key, "calls") == 0) {
+			sort = XDEBUG_PROFILER_SORT_CALLS;
+		} else {
+			php_error(E_WARNING, "Unknown sort key '%s'", sort_key);
+			RETURN_FALSE;
+		}
+	}
+
+	if (
+		!XG(profiler_enabled) ||
+		(XG(profiler_mode) != XDEBUG_PROFILER_MODE_MERGED && XG(profiler_mode) != XDEBUG_PROFILER_MODE_MEMORY)
+	) {
+		RETURN_FALSE;
+	}
+
+	xdebug_profiler_get_summary(return_value, limit, sort TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto array xdebug_get_profile_files()
+   Returns, per file loaded while the profiler runs, the time spent compiling
+   it, running its top level code and in the autoloader that loaded it, its
+   size and how often it was compiled and included */
+PHP_FUNCTION(xdebug_get_profile_files)
+{
+	if (!XG(profiler_enabled)) {
+		RETURN_FALSE;
+	}
+
+	xdebug_profiler_get_files(return_value TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto array xdebug_get_profile_categories()
+   Returns the time spent in, and the number of calls to, the internal
+   functions of each category in xdebug.profiler_categories */
+PHP_FUNCTION(xdebug_get_profile_categories)
+{
+	if (!XG(profiler_enabled)) {
+		RETURN_FALSE;
+	}
+
+	xdebug_profiler_get_categories(return_value TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto array xdebug_get_profile_sql()
+   Returns the number of runs, and the total and longest time, of each
+   statement run through PDO, with xdebug.profiler_sql */
+PHP_FUNCTION(xdebug_get_profile_sql)
+{
+	if (!XG(profiler_enabled) || !XG(profiler_sql)) {
+		RETURN_FALSE;
+	}
+
+	xdebug_profiler_get_sql(return_value TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto array xdebug_get_repeated_queries()
+   Returns the call sites that ran the same statement at least
+   xdebug.profiler_repeat_threshold times so far */
+PHP_FUNCTION(xdebug_get_repeated_queries)
+{
+	if (!XG(profiler_enabled) || XG(profiler_repeat_threshold) <= 0) {
+		RETURN_FALSE;
+	}
+
+	xdebug_profiler_get_repeats(return_value TSRMLS_CC);
+}
+/* }}} */
+
 PHP_FUNCTION(xdebug_dump_aggr_profiling_data)
 {
 	char *prefix = NULL;
@@ -1660,7 +2056,14 @@ PHP_FUNCTION(xdebug_clear_aggr_profiling_data)
 		RETURN_FALSE;
 	}
 
-	zend_hash_clean(&XG(aggr_calls));
+	if (xdebug_aggr_shared) {
+		xdebug_aggr_shm_clear(xdebug_aggr_shared);
+	} else {
+		zend_hash_clean(&XG(aggr_calls));
+	}
+	if (XG(aggr_sites)) {
+		zend_hash_clean(XG(aggr_sites));
+	}
 
 	RETURN_TRUE;
 }
@@ -1679,7 +2082,7 @@ PHP_FUNCTION(xdebug_peak_memory_usage)
 
 PHP_FUNCTION(xdebug_time_index)
 {
-	RETURN_DOUBLE(xdebug_get_utime() - XG(start_time));
+	RETURN_DOUBLE(XDEBUG_NANOTIME_TO_SECONDS(xdebug_get_nanotime() - XG(start_time)));
 }
 
 ZEND_DLEXPORT void xdebug_statement_call(zend_op_array *op_array)
@@ -1702,6 +2105,10 @@ ZEND_DLEXPORT void xdebug_statement_call(zend_op_array *op_array)
 		xdebug_count_line(file, lineno, 0, 0 TSRMLS_CC);
 	}
 
+	if (XG(profiler_enabled) && XG(profile_lines)) {
+		xdebug_profiler_statement(op_array, lineno TSRMLS_CC);
+	}
+
 	if (XG(remote_enabled)) {
 
 		if (XG(context).do_break) {
@@ -0,0 +1,410 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2010 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.0 of the Xdebug license,    |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | http://xdebug.derickrethans.nl/license.php                           |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | xdebug@derickrethans.nl so we can mail you a copy immediately.       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@xdebug.org>                         |
+   +----------------------------------------------------------------------+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdebug_aggregate_shm.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define XDEBUG_AGGR_SHM_HEADER_SIZE 64
+
+#define XDEBUG_AGGR_SHM_IS_EDGE(key) ((key) & 1)
+
+static size_t xdebug_aggr_shm_size(uint32_t slot_count)
+{
+	return XDEBUG_AGGR_SHM_HEADER_SIZE +
+		(size_t) slot_count * sizeof(xdebug_aggr_shm_slot) +
+		(size_t) slot_count * XDEBUG_AGGR_SHM_POOL_PER_SLOT;
+}
+
+static void xdebug_aggr_shm_init_header(xdebug_aggr_shm_header *header, uint32_t slot_count)
+{
+	header->magic = XDEBUG_AGGR_SHM_MAGIC;
+	header->version = XDEBUG_AGGR_SHM_VERSION;
+	header->slot_count = slot_count;
+	header->pool_size = slot_count * XDEBUG_AGGR_SHM_POOL_PER_SLOT;
+	header->pool_used = 1; /* offset 0 means "not set" */
+	header->dropped = 0;
+}
+
+xdebug_aggr_shm *xdebug_aggr_shm_open(const char *path, uint32_t slot_count, int create)
+{
+	xdebug_aggr_shm        *shm;
+	xdebug_aggr_shm_header  header;
+	struct stat             st;
+	void                   *map;
+	size_t                  size;
+	int                     fd, valid;
+
+	fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	/* Only one process at a time gets to check, and possibly create, the
+	 * layout */
+	flock(fd, LOCK_EX);
+
+	if (fstat(fd, &st) != 0) {
+		flock(fd, LOCK_UN);
+		close(fd);
+		return NULL;
+	}
+
+	/* Only a new, empty, file is ever sized. An existing table is used with
+	 * the slot count it was made with, as other processes may have it mapped,
+	 * and shrinking it under them would crash them. */
+	if (st.st_size == 0 && create && slot_count != 0) {
+		xdebug_aggr_shm_init_header(&header, slot_count);
+		if (ftruncate(fd, xdebug_aggr_shm_size(slot_count)) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+			flock(fd, LOCK_UN);
+			close(fd);
+			return NULL;
+		}
+		st.st_size = xdebug_aggr_shm_size(slot_count);
+	}
+
+	valid = (size_t) st.st_size >= sizeof(header) &&
+		pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+		header.magic == XDEBUG_AGGR_SHM_MAGIC &&
+		header.version == XDEBUG_AGGR_SHM_VERSION &&
+		(size_t) st.st_size == xdebug_aggr_shm_size(header.slot_count);
+
+	/* Anything else has to be removed by hand */
+	if (!valid) {
+		flock(fd, LOCK_UN);
+		close(fd);
+		return NULL;
+	}
+
+	size = xdebug_aggr_shm_size(header.slot_count);
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	shm = malloc(sizeof(xdebug_aggr_shm));
+	shm->header = (xdebug_aggr_shm_header *) map;
+	shm->slots = (xdebug_aggr_shm_slot *) ((char *) map + XDEBUG_AGGR_SHM_HEADER_SIZE);
+	shm->pool = (char *) (shm->slots + header.slot_count);
+	shm->size = size;
+
+	return shm;
+}
+
+void xdebug_aggr_shm_close(xdebug_aggr_shm *shm)
+{
+	munmap((void *) shm->header, shm->size);
+	free(shm);
+}
+
+/* 64 bit FNV-1a */
+static uint64_t xdebug_aggr_shm_hash(const char *data, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (len--) {
+		hash ^= (unsigned char) *data++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static uint32_t xdebug_aggr_shm_copy_name(xdebug_aggr_shm *shm, const char *name)
+{
+	uint32_t len = strlen(name) + 1;
+	uint32_t offset;
+
+	/* Checked first too, so that a full pool's pool_used stops growing
+	 * rather than wrapping around */
+	if (shm->header->pool_used + len > shm->header->pool_size) {
+		return 0;
+	}
+	offset = __sync_fetch_and_add(&shm->header->pool_used, len);
+	if (offset + len > shm->header->pool_size) {
+		return 0;
+	}
+	memcpy(shm->pool + offset, name, len);
+
+	return offset;
+}
+
+/* Finds the slot for key, or claims a free one. *created is set when this
+ * call claimed it, and the caller then fills in the rest of the slot. */
+static uint32_t xdebug_aggr_shm_find(xdebug_aggr_shm *shm, uint64_t key, int *created)
+{
+	uint32_t              count = shm->header->slot_count;
+	uint32_t              i, index;
+	xdebug_aggr_shm_slot *slot;
+
+	*created = 0;
+	for (i = 0; i < count; i++) {
+		index = (uint32_t) ((key + i) % count);
+		slot = &shm->slots[index];
+
+		if (slot->key == key) {
+			return index + 1;
+		}
+		if (slot->key == 0) {
+			if (__sync_bool_compare_and_swap(&slot->key, 0, key)) {
+				*created = 1;
+				return index + 1;
+			}
+			/* Somebody else just claimed it, possibly for the same key */
+			if (slot->key == key) {
+				return index + 1;
+			}
+		}
+	}
+
+	__sync_fetch_and_add(&shm->header->dropped, 1);
+	return 0;
+}
+
+uint32_t xdebug_aggr_shm_entry(xdebug_aggr_shm *shm, const char *key, size_t key_len, const char *filename, const char *function, int lineno)
+{
+	uint64_t              hash = xdebug_aggr_shm_hash(key, key_len) & ~(uint64_t) 1;
+	uint32_t              entry;
+	xdebug_aggr_shm_slot *slot;
+	int                   created;
+
+	if (!hash) {
+		hash = 2;
+	}
+
+	entry = xdebug_aggr_shm_find(shm, hash, &created);
+	if (entry && created) {
+		slot = &shm->slots[entry - 1];
+		slot->lineno = lineno;
+		slot->filename = xdebug_aggr_shm_copy_name(shm, filename);
+		slot->function = xdebug_aggr_shm_copy_name(shm, function);
+		/* An entry without its names can't be written out */
+		if (!slot->filename || !slot->function) {
+			__sync_fetch_and_add(&shm->header->dropped, 1);
+		}
+	}
+	return entry;
+}
+
+uint32_t xdebug_aggr_shm_edge(xdebug_aggr_shm *shm, uint32_t caller, uint32_t callee)
+{
+	uint64_t              hash;
+	uint32_t              entry;
+	xdebug_aggr_shm_slot *slot;
+	int                   created;
+
+	if (!caller || !callee) {
+		return 0;
+	}
+
+	hash = (((uint64_t) caller << 32) | callee) * 0x9E3779B97F4A7C15ULL;
+	hash |= 1;
+
+	entry = xdebug_aggr_shm_find(shm, hash, &created);
+	if (entry && created) {
+		slot = &shm->slots[entry - 1];
+		slot->caller = caller;
+		slot->callee = callee;
+	}
+	return entry;
+}
+
+void xdebug_aggr_shm_add(xdebug_aggr_shm *shm, uint32_t entry, xdebug_aggr_shm_cost *own, xdebug_aggr_shm_cost *inclusive)
+{
+	xdebug_aggr_shm_slot *slot;
+
+	if (!entry) {
+		return;
+	}
+	slot = &shm->slots[entry - 1];
+
+	__sync_fetch_and_add(&slot->call_count, 1);
+	__sync_fetch_and_add(&slot->time_own, own->time);
+	__sync_fetch_and_add(&slot->time_inclusive, inclusive->time);
+	__sync_fetch_and_add(&slot->memory_own, own->memory);
+	__sync_fetch_and_add(&slot->memory_inclusive, inclusive->memory);
+	__sync_fetch_and_add(&slot->peak_memory_own, own->peak_memory);
+	__sync_fetch_and_add(&slot->peak_memory_inclusive, inclusive->peak_memory);
+}
+
+void xdebug_aggr_shm_add_call(xdebug_aggr_shm *shm, uint32_t edge, xdebug_aggr_shm_cost *inclusive)
+{
+	xdebug_aggr_shm_slot *slot;
+
+	if (!edge) {
+		return;
+	}
+	slot = &shm->slots[edge - 1];
+
+	__sync_fetch_and_add(&slot->call_count, 1);
+	__sync_fetch_and_add(&slot->time_inclusive, inclusive->time);
+	__sync_fetch_and_add(&slot->memory_inclusive, inclusive->memory);
+	__sync_fetch_and_add(&slot->peak_memory_inclusive, inclusive->peak_memory);
+}
+
+/* Not atomic with respect to requests that are running at the same time;
+ * their updates can end up in the cleared table half-done. */
+void xdebug_aggr_shm_clear(xdebug_aggr_shm *shm)
+{
+	memset((void *) shm->slots, 0, (size_t) shm->header->slot_count * sizeof(xdebug_aggr_shm_slot));
+	xdebug_aggr_shm_init_header(shm->header, shm->header->slot_count);
+}
+
+/* Like the profiler, writes a net memory change as two unsigned costs:
+ * what it grew by, and what it shrank by */
+static unsigned long xdebug_aggr_shm_grown(int64_t memory)
+{
+	return memory > 0 ? (unsigned long) memory : 0;
+}
+
+static unsigned long xdebug_aggr_shm_shrunk(int64_t memory)
+{
+	return memory < 0 ? (unsigned long) -memory : 0;
+}
+
+static void xdebug_aggr_shm_printf(xdebug_aggr_shm_vprintf write, void *out, const char *fmt, ...)
+#ifdef __GNUC__
+	__attribute__ ((format (printf, 3, 4)))
+#endif
+	;
+
+static void xdebug_aggr_shm_printf(xdebug_aggr_shm_vprintf write, void *out, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	write(out, fmt, args);
+	va_end(args);
+}
+
+int xdebug_aggr_shm_dump(xdebug_aggr_shm *shm, xdebug_aggr_shm_vprintf write, void *out)
+{
+	uint32_t              count = shm->header->slot_count;
+	uint32_t             *first_edge, *next_edge;
+	uint32_t              i, e;
+	xdebug_aggr_shm_slot *slot, *edge, *callee;
+
+	/* Collect the edges of every entry first, so they can be written in one
+	 * pass */
+	first_edge = calloc(count + 1, sizeof(uint32_t));
+	next_edge = calloc(count + 1, sizeof(uint32_t));
+	if (!first_edge || !next_edge) {
+		free(first_edge);
+		free(next_edge);
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		slot = &shm->slots[i];
+		if (slot->key && XDEBUG_AGGR_SHM_IS_EDGE(slot->key) && slot->caller && slot->callee) {
+			next_edge[i + 1] = first_edge[slot->caller];
+			first_edge[slot->caller] = i + 1;
+		}
+	}
+
+	xdebug_aggr_shm_printf(write, out, "version: 0.9.6\ncmd: Aggregate\npart: 1\n\nevents: Time MemoryAllocated MemoryFreed PeakMemory\n\n");
+	if (shm->header->dropped) {
+		xdebug_aggr_shm_printf(write, out, "# %lu entries did not fit in the table\n\n", (unsigned long) shm->header->dropped);
+	}
+
+	for (i = 0; i < count; i++) {
+		slot = &shm->slots[i];
+		if (!slot->key || XDEBUG_AGGR_SHM_IS_EDGE(slot->key) || !slot->filename || !slot->function) {
+			continue;
+		}
+
+		xdebug_aggr_shm_printf(write, out, "fl=%s\n", shm->pool + slot->filename);
+		xdebug_aggr_shm_printf(write, out, "fn=%s\n", shm->pool + slot->function);
+		xdebug_aggr_shm_printf(write, out, "%d %lu %lu %lu %lu\n", 0, (unsigned long) (slot->time_own / 1000),
+			xdebug_aggr_shm_grown(slot->memory_own), xdebug_aggr_shm_shrunk(slot->memory_own), xdebug_aggr_shm_grown(slot->peak_memory_own));
+		if (strcmp(shm->pool + slot->function, "{main}") == 0) {
+			xdebug_aggr_shm_printf(write, out, "\nsummary: %lu %lu %lu %lu\n\n", (unsigned long) (slot->time_inclusive / 1000),
+				xdebug_aggr_shm_grown(slot->memory_inclusive), xdebug_aggr_shm_shrunk(slot->memory_inclusive), xdebug_aggr_shm_grown(slot->peak_memory_inclusive));
+		}
+
+		for (e = first_edge[i + 1]; e; e = next_edge[e]) {
+			edge = &shm->slots[e - 1];
+			callee = &shm->slots[edge->callee - 1];
+			if (!callee->function || !edge->call_count) {
+				continue;
+			}
+			xdebug_aggr_shm_printf(write, out, "cfn=%s\n", shm->pool + callee->function);
+			xdebug_aggr_shm_printf(write, out, "calls=%lu 0 0\n", (unsigned long) edge->call_count);
+			xdebug_aggr_shm_printf(write, out, "%d %lu %lu %lu %lu\n", callee->lineno, (unsigned long) (edge->time_inclusive / 1000),
+				xdebug_aggr_shm_grown(edge->memory_inclusive), xdebug_aggr_shm_shrunk(edge->memory_inclusive), xdebug_aggr_shm_grown(edge->peak_memory_inclusive));
+		}
+		xdebug_aggr_shm_printf(write, out, "\n");
+	}
+
+	free(first_edge);
+	free(next_edge);
+
+	return 0;
+}
+
+#else
+
+/* Windows has no mmap() and flock(); the shared aggregate is not available */
+xdebug_aggr_shm *xdebug_aggr_shm_open(const char *path, uint32_t slot_count, int create)
+{
+	return NULL;
+}
+
+void xdebug_aggr_shm_close(xdebug_aggr_shm *shm)
+{
+}
+
+uint32_t xdebug_aggr_shm_entry(xdebug_aggr_shm *shm, const char *key, size_t key_len, const char *filename, const char *function, int lineno)
+{
+	return 0;
+}
+
+uint32_t xdebug_aggr_shm_edge(xdebug_aggr_shm *shm, uint32_t caller, uint32_t callee)
+{
+	return 0;
+}
+
+void xdebug_aggr_shm_add(xdebug_aggr_shm *shm, uint32_t entry, xdebug_aggr_shm_cost *own, xdebug_aggr_shm_cost *inclusive)
+{
+}
+
+void xdebug_aggr_shm_add_call(xdebug_aggr_shm *shm, uint32_t edge, xdebug_aggr_shm_cost *inclusive)
+{
+}
+
+void xdebug_aggr_shm_clear(xdebug_aggr_shm *shm)
+{
+}
+
+int xdebug_aggr_shm_dump(xdebug_aggr_shm *shm, xdebug_aggr_shm_vprintf write, void *out)
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2010 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.0 of the Xdebug license,    |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | http://xdebug.derickrethans.nl/license.php                           |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | xdebug@derickrethans.nl so we can mail you a copy immediately.       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@xdebug.org>                         |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __HAVE_XDEBUG_AGGREGATE_SHM_H__
+#define __HAVE_XDEBUG_AGGREGATE_SHM_H__
+
+/* A fixed size aggregate profile in a shared, file backed, memory mapping,
+ * that all PHP processes on a host update at the same time. This file does
+ * not depend on PHP, as it is also used by contrib/xdebug-aggregate-dump.c.
+ *
+ * The table is an open addressing hash of slots. A slot is claimed with a
+ * compare-and-swap on its key, and its counters are only ever changed with
+ * atomic adds, so no locks are needed. A slot is either a function entry
+ * (a function called from a specific file and line, like the entries of the
+ * per process aggregate), or an edge from a caller entry to a callee entry,
+ * which counts the calls made along it and their inclusive cost. Names are
+ * copied once into a string pool after the slots. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#ifdef _MSC_VER
+typedef unsigned __int32 uint32_t;
+typedef unsigned __int64 uint64_t;
+typedef __int64          int64_t;
+#else
+# include <stdint.h>
+#endif
+
+#define XDEBUG_AGGR_SHM_MAGIC    0x58444147 /* "XDAG" */
+#define XDEBUG_AGGR_SHM_VERSION  2
+
+/* Bytes of string pool per slot */
+#define XDEBUG_AGGR_SHM_POOL_PER_SLOT 128
+
+typedef struct _xdebug_aggr_shm_header {
+	uint32_t          magic;
+	uint32_t          version;
+	uint32_t          slot_count;
+	uint32_t          pool_size;
+	volatile uint32_t pool_used;
+	volatile uint32_t dropped; /* entries that did not fit in the slots or the pool */
+} xdebug_aggr_shm_header;
+
+typedef struct _xdebug_aggr_shm_slot {
+	volatile uint64_t key;     /* 0 for a free slot, the lowest bit is set for edges */
+	volatile uint32_t filename; /* pool offsets, 0 until set */
+	volatile uint32_t function;
+	volatile uint32_t lineno;
+	volatile uint32_t caller;  /* slot numbers (index + 1) of an edge */
+	volatile uint32_t callee;
+	uint32_t          padding;
+	volatile uint64_t call_count;
+	volatile uint64_t time_own; /* nanoseconds; the own costs are not used by edges */
+	volatile uint64_t time_inclusive;
+	volatile int64_t  memory_own;
+	volatile int64_t  memory_inclusive;
+	volatile int64_t  peak_memory_own;
+	volatile int64_t  peak_memory_inclusive;
+} xdebug_aggr_shm_slot;
+
+typedef struct _xdebug_aggr_shm {
+	xdebug_aggr_shm_header *header;
+	xdebug_aggr_shm_slot   *slots;
+	char                   *pool;
+	size_t                  size;
+} xdebug_aggr_shm;
+
+typedef struct _xdebug_aggr_shm_cost {
+	uint64_t time;
+	int64_t  memory;
+	int64_t  peak_memory;
+} xdebug_aggr_shm_cost;
+
+/* Maps the table in the file at path. When create is set, the file is
+ * created (or reset when it has a different layout) with the given number
+ * of slots, otherwise the existing file is mapped as is. */
+xdebug_aggr_shm *xdebug_aggr_shm_open(const char *path, uint32_t slot_count, int create);
+void xdebug_aggr_shm_close(xdebug_aggr_shm *shm);
+
+/* Both return a slot number, or 0 when the table is full */
+uint32_t xdebug_aggr_shm_entry(xdebug_aggr_shm *shm, const char *key, size_t key_len, const char *filename, const char *function, int lineno);
+uint32_t xdebug_aggr_shm_edge(xdebug_aggr_shm *shm, uint32_t caller, uint32_t callee);
+
+void xdebug_aggr_shm_add(xdebug_aggr_shm *shm, uint32_t entry, xdebug_aggr_shm_cost *own, xdebug_aggr_shm_cost *inclusive);
+void xdebug_aggr_shm_add_call(xdebug_aggr_shm *shm, uint32_t edge, xdebug_aggr_shm_cost *inclusive);
+void xdebug_aggr_shm_clear(xdebug_aggr_shm *shm);
+
+/* Where a dump is written to: a vprintf() like function, and what it writes
+ * to, such as a FILE * for vfprintf() */
+typedef int (*xdebug_aggr_shm_vprintf)(void *out, const char *fmt, va_list args);
+
+/* Writes a snapshot of the table as a cachegrind file */
+int xdebug_aggr_shm_dump(xdebug_aggr_shm *shm, xdebug_aggr_shm_vprintf write, void *out);
+
+#endif
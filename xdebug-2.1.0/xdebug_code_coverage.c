@@ -232,8 +232,8 @@ static int xdebug_common_assign_dim_handler(char *op, int do_cc, ZEND_OPCODE_HAN
 		fse = XDEBUG_LLIST_VALP(XDEBUG_LLIST_TAIL(XG(stack)));
 		t = xdebug_return_trace_assignment(fse, full_varname, val, op, file, lineno TSRMLS_CC);
 		xdfree(full_varname);
-		fprintf(XG(trace_file), "%s", t);
-		fflush(XG(trace_file));
+		xdebug_file_write(XG(trace_file), t, strlen(t));
+		xdebug_file_flush(XG(trace_file));
 		xdfree(t);
 	}
 	return ZEND_USER_OPCODE_DISPATCH;
@@ -0,0 +1,725 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2010 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.0 of the Xdebug license,    |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | http://xdebug.derickrethans.nl/license.php                           |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | xdebug@derickrethans.nl so we can mail you a copy immediately.       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@xdebug.org>                         |
+   +----------------------------------------------------------------------+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "php.h"
+
+#include "xdebug_file.h"
+#include "xdebug_mm.h"
+#include "xdebug_str.h"
+#include "usefulstuff.h"
+
+#ifdef HAVE_XDEBUG_ZLIB
+# include <zlib.h>
+
+/* Size of the block compressed data is collected in before it is written */
+# define XDEBUG_FILE_GZIP_BUFFER_SIZE (64 * 1024)
+#endif
+
+#ifndef PHP_WIN32
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# define XDEBUG_FILE_HAVE_MMAP 1
+#endif
+
+#if defined(HAVE_XDEBUG_PTHREAD) && !defined(PHP_WIN32)
+# include <pthread.h>
+# define XDEBUG_FILE_HAVE_ASYNC 1
+#endif
+
+#ifdef XDEBUG_FILE_HAVE_ASYNC
+static int xdebug_file_write_through(xdebug_file *file, const char *data, size_t len);
+
+/* The queue of filled buffers and the writer thread that empties it. All of
+ * it, including the in_flight and spare fields of the files, is protected by
+ * the one mutex; with buffers the size they are, that lock is not what
+ * costs time. */
+typedef struct _xdebug_file_queue_entry {
+	xdebug_file *file;
+	char        *data;
+	size_t       len;
+	size_t       size;
+} xdebug_file_queue_entry;
+
+static pthread_mutex_t         xdebug_file_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t          xdebug_file_queue_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t          xdebug_file_queue_emptied = PTHREAD_COND_INITIALIZER;
+static xdebug_file_queue_entry xdebug_file_queue[XDEBUG_FILE_QUEUE_LENGTH];
+static unsigned int            xdebug_file_queue_head = 0;
+static unsigned int            xdebug_file_queue_count = 0;
+static int                     xdebug_file_writer_running = 0;
+static int                     xdebug_file_writer_stopping = 0;
+static pthread_t               xdebug_file_writer;
+
+static void *xdebug_file_writer_main(void *arg)
+{
+	xdebug_file_queue_entry *entry;
+	int                      ret;
+
+	pthread_mutex_lock(&xdebug_file_queue_lock);
+	while (1) {
+		while (!xdebug_file_queue_count && !xdebug_file_writer_stopping) {
+			pthread_cond_wait(&xdebug_file_queue_filled, &xdebug_file_queue_lock);
+		}
+		if (!xdebug_file_queue_count) {
+			break;
+		}
+
+		/* The entry stays in the queue until it is written, which keeps the
+		 * files' buffers in order */
+		entry = &xdebug_file_queue[xdebug_file_queue_head];
+		pthread_mutex_unlock(&xdebug_file_queue_lock);
+		ret = xdebug_file_write_through(entry->file, entry->data, entry->len);
+		pthread_mutex_lock(&xdebug_file_queue_lock);
+
+		if (ret == FAILURE) {
+			entry->file->async_error = 1;
+		}
+		if (entry->size == entry->file->buffer_size) {
+			*(char **) entry->data = entry->file->spare;
+			entry->file->spare = entry->data;
+		} else {
+			xdfree(entry->data);
+		}
+		entry->file->in_flight--;
+		xdebug_file_queue_head = (xdebug_file_queue_head + 1) % XDEBUG_FILE_QUEUE_LENGTH;
+		xdebug_file_queue_count--;
+		pthread_cond_broadcast(&xdebug_file_queue_emptied);
+	}
+	pthread_mutex_unlock(&xdebug_file_queue_lock);
+
+	return NULL;
+}
+
+/* A forked child gets a copy of the queue, but not the thread emptying it.
+ * The lock is held across the fork so that the copy is consistent, and the
+ * child then forgets about the queued buffers, which are the parent's to
+ * write; the writer is started again by the child's next enqueue. */
+static void xdebug_file_atfork_prepare(void)
+{
+	pthread_mutex_lock(&xdebug_file_queue_lock);
+}
+
+static void xdebug_file_atfork_parent(void)
+{
+	pthread_mutex_unlock(&xdebug_file_queue_lock);
+}
+
+static void xdebug_file_atfork_child(void)
+{
+	xdebug_file_queue_entry *entry;
+
+	while (xdebug_file_queue_count) {
+		entry = &xdebug_file_queue[xdebug_file_queue_head];
+		if (entry->size == entry->file->buffer_size) {
+			*(char **) entry->data = entry->file->spare;
+			entry->file->spare = entry->data;
+		} else {
+			xdfree(entry->data);
+		}
+		entry->file->in_flight = 0;
+		xdebug_file_queue_head = (xdebug_file_queue_head + 1) % XDEBUG_FILE_QUEUE_LENGTH;
+		xdebug_file_queue_count--;
+	}
+	xdebug_file_queue_head = 0;
+	xdebug_file_writer_running = 0;
+
+	pthread_mutex_unlock(&xdebug_file_queue_lock);
+	pthread_cond_init(&xdebug_file_queue_filled, NULL);
+	pthread_cond_init(&xdebug_file_queue_emptied, NULL);
+}
+
+static void xdebug_file_atfork_register(void)
+{
+	pthread_atfork(xdebug_file_atfork_prepare, xdebug_file_atfork_parent, xdebug_file_atfork_child);
+}
+
+/* Starts the writer thread if it isn't running yet; called with the lock
+ * held */
+static int xdebug_file_writer_start_locked(void)
+{
+	if (!xdebug_file_writer_running) {
+		xdebug_file_writer_stopping = 0;
+		if (pthread_create(&xdebug_file_writer, NULL, xdebug_file_writer_main, NULL) != 0) {
+			return FAILURE;
+		}
+		xdebug_file_writer_running = 1;
+	}
+	return SUCCESS;
+}
+
+static int xdebug_file_writer_start(void)
+{
+	static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+	int ret;
+
+	pthread_once(&atfork_once, xdebug_file_atfork_register);
+
+	pthread_mutex_lock(&xdebug_file_queue_lock);
+	ret = xdebug_file_writer_start_locked();
+	pthread_mutex_unlock(&xdebug_file_queue_lock);
+
+	return ret;
+}
+
+/* Puts a block of data in the queue, waiting for room or dropping it
+ * depending on the file's policy. Returns whether it was queued; if so, and
+ * spare is given, it is set to a written buffer of the file to reuse, if
+ * there is one. */
+static int xdebug_file_enqueue(xdebug_file *file, char *data, size_t len, size_t size, char **spare)
+{
+	xdebug_file_queue_entry *entry;
+
+	pthread_mutex_lock(&xdebug_file_queue_lock);
+	if (xdebug_file_queue_count == XDEBUG_FILE_QUEUE_LENGTH && file->async == XDEBUG_FILE_OPT_ASYNC_DROP) {
+		pthread_mutex_unlock(&xdebug_file_queue_lock);
+		file->dropped_bytes += len;
+		return 0;
+	}
+	if (xdebug_file_writer_start_locked() == FAILURE) {
+		pthread_mutex_unlock(&xdebug_file_queue_lock);
+		file->async_error = 1;
+		return 0;
+	}
+	while (xdebug_file_queue_count == XDEBUG_FILE_QUEUE_LENGTH) {
+		pthread_cond_wait(&xdebug_file_queue_emptied, &xdebug_file_queue_lock);
+	}
+
+	entry = &xdebug_file_queue[(xdebug_file_queue_head + xdebug_file_queue_count) % XDEBUG_FILE_QUEUE_LENGTH];
+	entry->file = file;
+	entry->data = data;
+	entry->len  = len;
+	entry->size = size;
+	xdebug_file_queue_count++;
+	file->in_flight++;
+
+	if (spare) {
+		*spare = file->spare;
+		if (file->spare) {
+			file->spare = *(char **) file->spare;
+		}
+	}
+	pthread_cond_signal(&xdebug_file_queue_filled);
+	pthread_mutex_unlock(&xdebug_file_queue_lock);
+
+	return 1;
+}
+
+/* Queues the filled buffer of an asynchronous file, and carries on in an
+ * empty one */
+static int xdebug_file_submit(xdebug_file *file)
+{
+	char *spare;
+
+	if (file->async_error) {
+		return FAILURE;
+	}
+	if (file->buffer_used && xdebug_file_enqueue(file, file->buffer, file->buffer_used, file->buffer_size, &spare)) {
+		file->buffer = spare ? spare : xdmalloc(file->buffer_size);
+	}
+	file->buffer_used = 0;
+
+	return SUCCESS;
+}
+
+/* Queues data that doesn't fit in a buffer, in a block of its own */
+static int xdebug_file_submit_data(xdebug_file *file, const char *data, size_t len)
+{
+	char *block;
+
+	if (file->async_error) {
+		return FAILURE;
+	}
+	block = xdmalloc(len);
+	memcpy(block, data, len);
+	if (!xdebug_file_enqueue(file, block, len, len, NULL)) {
+		xdfree(block);
+	}
+
+	return SUCCESS;
+}
+
+/* Waits until the writer thread has written everything of the file */
+static int xdebug_file_wait(xdebug_file *file)
+{
+	pthread_mutex_lock(&xdebug_file_queue_lock);
+	while (file->in_flight) {
+		pthread_cond_wait(&xdebug_file_queue_emptied, &xdebug_file_queue_lock);
+	}
+	pthread_mutex_unlock(&xdebug_file_queue_lock);
+
+	return file->async_error ? FAILURE : SUCCESS;
+}
+#endif
+
+void xdebug_file_writer_stop(void)
+{
+#ifdef XDEBUG_FILE_HAVE_ASYNC
+	pthread_t writer;
+	int       running;
+
+	/* The handle is copied while the lock is held, as an enqueue may start
+	 * a new writer, and overwrite it, as soon as the lock is released */
+	pthread_mutex_lock(&xdebug_file_queue_lock);
+	running = xdebug_file_writer_running;
+	writer = xdebug_file_writer;
+	xdebug_file_writer_stopping = 1;
+	xdebug_file_writer_running = 0;
+	pthread_cond_signal(&xdebug_file_queue_filled);
+	pthread_mutex_unlock(&xdebug_file_queue_lock);
+
+	if (running) {
+		pthread_join(writer, NULL);
+	}
+#endif
+}
+
+#ifdef XDEBUG_FILE_HAVE_MMAP
+/* Makes sure the file has disk space up to length. Writing into a mapped
+ * page that has no space behind it raises SIGBUS, so the space is reserved
+ * for real where the system supports that. */
+static int xdebug_file_allocate(xdebug_file *file, off_t length)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+	if (posix_fallocate(file->fd, file->allocated, length - file->allocated) == 0) {
+		file->allocated = length;
+		return SUCCESS;
+	}
+#endif
+	if (ftruncate(file->fd, length) != 0) {
+		return FAILURE;
+	}
+	file->allocated = length;
+	return SUCCESS;
+}
+
+/* Maps a window of the file in which at least len bytes can be written from
+ * position on */
+static int xdebug_file_map(xdebug_file *file, off_t position, size_t len)
+{
+	long    page_size = sysconf(_SC_PAGESIZE);
+	off_t   start = position - position % page_size;
+	size_t  skip = position - start;
+	size_t  size = XDEBUG_FILE_MMAP_CHUNK_SIZE;
+	void   *map;
+
+	while (size < skip + len) {
+		size *= 2;
+	}
+
+	/* Until the mapping succeeds, the position stays in map_offset */
+	file->map = NULL;
+	file->map_offset = position;
+	file->buffer = NULL;
+	file->buffer_size = 0;
+	file->buffer_used = 0;
+
+	if (start + (off_t) size > file->allocated && xdebug_file_allocate(file, start + size) == FAILURE) {
+		return FAILURE;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, start);
+	if (map == MAP_FAILED) {
+		return FAILURE;
+	}
+
+	file->map = map;
+	file->map_size = size;
+	file->map_offset = start;
+	file->buffer = file->map + skip;
+	file->buffer_size = size - skip;
+
+	return SUCCESS;
+}
+
+static off_t xdebug_file_position(xdebug_file *file)
+{
+	return file->map_offset + (file->buffer - file->map) + file->buffer_used;
+}
+#endif
+
+#ifdef HAVE_XDEBUG_ZLIB
+static int xdebug_file_gzip_init(xdebug_file *file, int level)
+{
+	z_stream *z = xdcalloc(1, sizeof(z_stream));
+
+	/* 16 added to the window bits asks for a gzip header and trailer */
+	if (deflateInit2(z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		xdfree(z);
+		return FAILURE;
+	}
+	file->z_stream = z;
+	file->z_buffer = xdmalloc(XDEBUG_FILE_GZIP_BUFFER_SIZE);
+
+	return SUCCESS;
+}
+
+static int xdebug_file_deflate(xdebug_file *file, const char *data, size_t len, int flush)
+{
+	z_stream *z = (z_stream *) file->z_stream;
+	size_t    have;
+
+	z->next_in = (Bytef *) data;
+	z->avail_in = len;
+	do {
+		z->next_out = (Bytef *) file->z_buffer;
+		z->avail_out = XDEBUG_FILE_GZIP_BUFFER_SIZE;
+		if (deflate(z, flush) == Z_STREAM_ERROR) {
+			return FAILURE;
+		}
+		have = XDEBUG_FILE_GZIP_BUFFER_SIZE - z->avail_out;
+		if (have) {
+			if (fwrite(file->z_buffer, 1, have, file->fp) != have) {
+				return FAILURE;
+			}
+			file->bytes_written += have;
+			file->flush_count++;
+		}
+	} while (z->avail_out == 0);
+
+	return SUCCESS;
+}
+
+static int xdebug_file_compress(xdebug_file *file, const char *data, size_t len)
+{
+	if (xdebug_file_deflate(file, data, len, Z_NO_FLUSH) == FAILURE) {
+		return FAILURE;
+	}
+
+	file->z_pending += len;
+	if (file->z_pending >= XDEBUG_FILE_GZIP_BLOCK_SIZE) {
+		file->z_pending = 0;
+		return xdebug_file_deflate(file, NULL, 0, Z_SYNC_FLUSH);
+	}
+	return SUCCESS;
+}
+
+static void xdebug_file_gzip_close(xdebug_file *file)
+{
+	xdebug_file_deflate(file, NULL, 0, Z_FINISH);
+	deflateEnd((z_stream *) file->z_stream);
+
+	xdfree(file->z_stream);
+	xdfree(file->z_buffer);
+}
+#endif
+
+xdebug_file *xdebug_file_open(char *fname, char *mode, char *extension, char **new_fname, long buffer_size, int options)
+{
+	xdebug_file *file;
+	FILE        *fp;
+	char         rw_mode[3] = { mode[0], '+', '\0' };
+	char        *gz_extension = NULL;
+#ifdef HAVE_XDEBUG_ZLIB
+	int          gzip = 0;
+#endif
+
+#ifdef HAVE_XDEBUG_ZLIB
+	if (options & (XDEBUG_FILE_OPT_GZIP | XDEBUG_FILE_OPT_GZIP_FAST)) {
+		gzip = 1;
+		gz_extension = extension ? xdebug_sprintf("%s.gz", extension) : xdstrdup("gz");
+		extension = gz_extension;
+		options &= ~XDEBUG_FILE_OPT_MMAP;
+	}
+#endif
+
+	/* Appending writers may share the file, and a mapping would write over
+	 * whatever the others added after it was made */
+	if (mode[0] == 'a') {
+		options &= ~XDEBUG_FILE_OPT_MMAP;
+	}
+
+	/* A shared mapping can only be written when the file is open for reading
+	 * as well */
+	fp = xdebug_fopen(fname, (options & XDEBUG_FILE_OPT_MMAP) ? rw_mode : mode, extension, new_fname);
+	if (gz_extension) {
+		xdfree(gz_extension);
+	}
+	if (!fp) {
+		return NULL;
+	}
+
+	file = xdmalloc(sizeof(xdebug_file));
+	file->fp            = fp;
+	file->fd            = -1;
+	file->map           = NULL;
+	file->map_size      = 0;
+	file->map_offset    = 0;
+	file->allocated     = 0;
+	file->z_stream      = NULL;
+	file->z_buffer      = NULL;
+	file->z_pending     = 0;
+	file->async         = 0;
+	file->async_error   = 0;
+	file->in_flight     = 0;
+	file->spare         = NULL;
+	file->dropped_bytes = 0;
+	file->bytes_submitted = 0;
+	file->bytes_written = 0;
+	file->flush_count   = 0;
+
+#ifdef HAVE_XDEBUG_ZLIB
+	if (gzip && xdebug_file_gzip_init(file, (options & XDEBUG_FILE_OPT_GZIP_FAST) ? 1 : Z_DEFAULT_COMPRESSION) == FAILURE) {
+		fclose(fp);
+		xdfree(file);
+		return NULL;
+	}
+#endif
+
+#ifdef XDEBUG_FILE_HAVE_MMAP
+	if (options & XDEBUG_FILE_OPT_MMAP) {
+		struct stat buf;
+
+		file->fd = fileno(fp);
+		if (fstat(file->fd, &buf) == 0) {
+			file->allocated = buf.st_size;
+			if (xdebug_file_map(file, buf.st_size, 0) == SUCCESS) {
+				file->flush_count++;
+				return file;
+			}
+			ftruncate(file->fd, buf.st_size);
+		}
+		/* Fall back to normal buffered writes */
+		file->fd = -1;
+	}
+#endif
+
+#ifdef XDEBUG_FILE_HAVE_ASYNC
+	if ((options & (XDEBUG_FILE_OPT_ASYNC | XDEBUG_FILE_OPT_ASYNC_DROP)) && xdebug_file_writer_start() == SUCCESS) {
+		file->async = (options & XDEBUG_FILE_OPT_ASYNC_DROP) ? XDEBUG_FILE_OPT_ASYNC_DROP : XDEBUG_FILE_OPT_ASYNC;
+	}
+#endif
+
+	/* We do our own buffering, so there is no need for stdio to do it too */
+	setvbuf(fp, NULL, _IONBF, 0);
+
+	if (buffer_size < XDEBUG_FILE_MIN_BUFFER_SIZE) {
+		buffer_size = XDEBUG_FILE_MIN_BUFFER_SIZE;
+	}
+
+	file->buffer        = xdmalloc(buffer_size);
+	file->buffer_size   = buffer_size;
+	file->buffer_used   = 0;
+
+	return file;
+}
+
+static int xdebug_file_write_through(xdebug_file *file, const char *data, size_t len)
+{
+#ifdef HAVE_XDEBUG_ZLIB
+	if (file->z_stream) {
+		return xdebug_file_compress(file, data, len);
+	}
+#endif
+	if (fwrite(data, 1, len, file->fp) != len) {
+		return FAILURE;
+	}
+	file->bytes_written += len;
+	file->flush_count++;
+
+	return SUCCESS;
+}
+
+int xdebug_file_flush(xdebug_file *file)
+{
+	int ret = SUCCESS;
+
+	/* Waiting for the disk is what asynchronous output is there to avoid */
+	if (file->async) {
+		return file->async_error ? FAILURE : SUCCESS;
+	}
+
+	/* Mapped data is already in the file; only account for it, and move the
+	 * start of the buffer past it */
+	if (file->fd != -1) {
+		file->bytes_written += file->buffer_used;
+		file->buffer += file->buffer_used;
+		file->buffer_size -= file->buffer_used;
+		file->buffer_used = 0;
+		return SUCCESS;
+	}
+
+	if (file->buffer_used) {
+		ret = xdebug_file_write_through(file, file->buffer, file->buffer_used);
+		file->buffer_used = 0;
+	}
+	return ret;
+}
+
+/* Flushes the file, and for an asynchronous file waits until the writer
+ * thread has written all of it */
+int xdebug_file_sync(xdebug_file *file)
+{
+#ifdef XDEBUG_FILE_HAVE_ASYNC
+	if (file->async) {
+		if (xdebug_file_submit(file) == FAILURE) {
+			return FAILURE;
+		}
+		return xdebug_file_wait(file);
+	}
+#endif
+	return xdebug_file_flush(file);
+}
+
+/* Empties the buffer, or for a mapped file moves on to a new window in which
+ * at least len more bytes fit */
+static int xdebug_file_make_room(xdebug_file *file, size_t len)
+{
+#ifdef XDEBUG_FILE_HAVE_ASYNC
+	if (file->async) {
+		return xdebug_file_submit(file);
+	}
+#endif
+#ifdef XDEBUG_FILE_HAVE_MMAP
+	if (file->fd != -1) {
+		off_t position;
+
+		if (!file->map) {
+			return FAILURE;
+		}
+		xdebug_file_flush(file);
+		position = xdebug_file_position(file);
+		munmap(file->map, file->map_size);
+		file->flush_count++;
+
+		return xdebug_file_map(file, position, len);
+	}
+#endif
+	return xdebug_file_flush(file);
+}
+
+int xdebug_file_write(xdebug_file *file, const char *data, size_t len)
+{
+	file->bytes_submitted += len;
+	if (file->buffer_used + len > file->buffer_size) {
+		if (xdebug_file_make_room(file, len) == FAILURE) {
+			return -1;
+		}
+
+		/* Data that doesn't fit in an empty buffer is not buffered at all */
+		if (len > file->buffer_size) {
+#ifdef XDEBUG_FILE_HAVE_ASYNC
+			if (file->async) {
+				return xdebug_file_submit_data(file, data, len) == SUCCESS ? (int) len : -1;
+			}
+#endif
+			return xdebug_file_write_through(file, data, len) == SUCCESS ? (int) len : -1;
+		}
+	}
+
+	memcpy(file->buffer + file->buffer_used, data, len);
+	file->buffer_used += len;
+
+	return len;
+}
+
+int xdebug_file_vprintf(xdebug_file *file, const char *fmt, va_list args)
+{
+	va_list  tmp_args;
+	int      len;
+	char    *tmp;
+
+	/* Try to format straight into the free space at the end of the buffer */
+	va_copy(tmp_args, args);
+	len = vsnprintf(file->buffer + file->buffer_used, file->buffer_size - file->buffer_used, fmt, tmp_args);
+	va_end(tmp_args);
+
+	if (len < 0) {
+		return -1;
+	}
+	if ((size_t) len < file->buffer_size - file->buffer_used) {
+		file->buffer_used += len;
+		file->bytes_submitted += len;
+		return len;
+	}
+
+	/* It didn't fit, so make room and try again; vsnprintf() needs space for
+	 * the closing \0 too */
+	if (xdebug_file_make_room(file, len + 1) == FAILURE) {
+		return -1;
+	}
+	if ((size_t) len < file->buffer_size) {
+		vsnprintf(file->buffer, file->buffer_size, fmt, args);
+		file->buffer_used = len;
+		file->bytes_submitted += len;
+	} else {
+		tmp = xdmalloc(len + 1);
+		vsnprintf(tmp, len + 1, fmt, args);
+		len = xdebug_file_write(file, tmp, len);
+		xdfree(tmp);
+	}
+
+	return len;
+}
+
+int xdebug_file_printf(xdebug_file *file, const char *fmt, ...)
+{
+	va_list args;
+	int     len;
+
+	va_start(args, fmt);
+	len = xdebug_file_vprintf(file, fmt, args);
+	va_end(args);
+
+	return len;
+}
+
+void xdebug_file_close(xdebug_file *file)
+{
+#ifdef XDEBUG_FILE_HAVE_MMAP
+	if (file->fd != -1) {
+		xdebug_file_flush(file);
+
+		/* Cut off the preallocated part that was never written to */
+		ftruncate(file->fd, xdebug_file_position(file));
+		if (file->map) {
+			munmap(file->map, file->map_size);
+		}
+		fclose(file->fp);
+		xdfree(file);
+		return;
+	}
+#endif
+	xdebug_file_sync(file);
+#ifdef XDEBUG_FILE_HAVE_ASYNC
+	while (file->spare) {
+		char *next = *(char **) file->spare;
+
+		xdfree(file->spare);
+		file->spare = next;
+	}
+#endif
+#ifdef HAVE_XDEBUG_ZLIB
+	if (file->z_stream) {
+		xdebug_file_gzip_close(file);
+	}
+#endif
+	fclose(file->fp);
+
+	xdfree(file->buffer);
+	xdfree(file);
+}
@@ -0,0 +1,124 @@
+/*
+   +----------------------------------------------------------------------+
+   | Xdebug                                                               |
+   +----------------------------------------------------------------------+
+   | Copyright (c) 2002-2010 Derick Rethans                               |
+   +----------------------------------------------------------------------+
+   | This source file is subject to version 1.0 of the Xdebug license,    |
+   | that is bundled with this package in the file LICENSE, and is        |
+   | available at through the world-wide-web at                           |
+   | http://xdebug.derickrethans.nl/license.php                           |
+   | If you did not receive a copy of the Xdebug license and are unable   |
+   | to obtain it through the world-wide-web, please send a note to       |
+   | xdebug@derickrethans.nl so we can mail you a copy immediately.       |
+   +----------------------------------------------------------------------+
+   | Authors:  Derick Rethans <derick@xdebug.org>                         |
+   +----------------------------------------------------------------------+
+ */
+
+#ifndef __HAVE_XDEBUG_FILE_H__
+#define __HAVE_XDEBUG_FILE_H__
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define XDEBUG_FILE_MIN_BUFFER_SIZE 4096
+
+/* Options for xdebug_file_open() */
+#define XDEBUG_FILE_OPT_MMAP      1
+#define XDEBUG_FILE_OPT_GZIP      2
+#define XDEBUG_FILE_OPT_GZIP_FAST 4
+#define XDEBUG_FILE_OPT_ASYNC     8  /* wait for room in the queue when it is full */
+#define XDEBUG_FILE_OPT_ASYNC_DROP 16 /* throw the data away when the queue is full */
+
+/* A compressed file is flushed to a byte boundary after every this many
+ * bytes of input, so that a partially written file can be decompressed up
+ * to the last such point */
+#define XDEBUG_FILE_GZIP_BLOCK_SIZE (256 * 1024)
+
+/* Number of filled buffers that can wait for the writer thread, for all
+ * asynchronous files in the process together */
+#define XDEBUG_FILE_QUEUE_LENGTH 32
+
+/* Size of the windows a memory mapped file is written through; the file is
+ * grown by (at least) this much at a time */
+#define XDEBUG_FILE_MMAP_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* A buffered output file. Everything written to it is collected in one
+ * userspace block which is only handed to the kernel when it fills up, or
+ * when the file is explicitly flushed or closed.
+ *
+ * A file opened with XDEBUG_FILE_OPT_MMAP is instead written through a
+ * shared mapping of a preallocated part of the file, so that the data
+ * belongs to the kernel as soon as it is copied in, and survives the process
+ * being killed. The file is truncated to the length actually written when it
+ * is closed.
+ *
+ * A file opened with XDEBUG_FILE_OPT_GZIP or _GZIP_FAST gets a ".gz"
+ * extension, and everything that leaves the buffer goes through a deflate
+ * stream first. Compression takes precedence over mapping.
+ *
+ * A file opened with XDEBUG_FILE_OPT_ASYNC or _ASYNC_DROP hands every
+ * filled buffer to a writer thread shared by the whole process, and carries
+ * on in a fresh one, so that the request never waits for the disk.
+ * xdebug_file_flush() leaves the buffer alone for such a file; only
+ * xdebug_file_sync() and xdebug_file_close() wait for the writer. When the
+ * queue is full, _ASYNC waits for room and _ASYNC_DROP throws the buffer
+ * away and counts it in dropped_bytes. Compression then happens on the
+ * writer thread too. A mapped file has no use for the writer thread. A
+ * forked child leaves the buffers queued before the fork to its parent, and
+ * gets a writer thread of its own when it queues its first buffer. */
+typedef struct _xdebug_file {
+	FILE          *fp;
+	char          *buffer;
+	size_t         buffer_size;
+	size_t         buffer_used;
+
+	/* memory mapped output, fd is -1 when not used */
+	int            fd;
+	char          *map;
+	size_t         map_size;
+	off_t          map_offset;
+	off_t          allocated;
+
+	/* compressed output, z_stream is NULL when not used */
+	void          *z_stream;
+	char          *z_buffer;
+	size_t         z_pending; /* input since the last sync point */
+
+	/* asynchronous output, async is 0 when not used */
+	int            async;
+	int            async_error;
+	unsigned int   in_flight; /* buffers in the queue */
+	char          *spare;     /* written buffers, ready for reuse */
+	unsigned long  dropped_bytes;
+
+	/* everything handed to the file so far, before compression; kept by the
+	 * writing thread alone, so it is exact at any time */
+	unsigned long  bytes_submitted;
+
+	/* statistics; for an asynchronous file only exact after a sync */
+	unsigned long  bytes_written;
+	unsigned long  flush_count;
+} xdebug_file;
+
+xdebug_file *xdebug_file_open(char *fname, char *mode, char *extension, char **new_fname, long buffer_size, int options);
+int xdebug_file_write(xdebug_file *file, const char *data, size_t len);
+int xdebug_file_vprintf(xdebug_file *file, const char *fmt, va_list args)
+#ifdef __GNUC__
+	__attribute__ ((format (printf, 2, 0)))
+#endif
+	;
+int xdebug_file_printf(xdebug_file *file, const char *fmt, ...)
+#ifdef __GNUC__
+	__attribute__ ((format (printf, 2, 3)))
+#endif
+	;
+int xdebug_file_flush(xdebug_file *file);
+int xdebug_file_sync(xdebug_file *file);
+void xdebug_file_close(xdebug_file *file);
+
+void xdebug_file_writer_stop(void);
+
+#endif
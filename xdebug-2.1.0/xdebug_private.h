@@ -31,6 +31,7 @@
 #include "zend_hash.h"
 #include "xdebug_hash.h"
 #include "xdebug_llist.h"
+#include "usefulstuff.h"
 
 #define MICRO_IN_SEC 1000000.00
 
@@ -129,13 +130,107 @@ typedef struct _xdebug_func {
 	int   internal;
 } xdebug_func;
 
+#define XDEBUG_PROFILER_MODE_FULL    0
+#define XDEBUG_PROFILER_MODE_MERGED  1
+#define XDEBUG_PROFILER_MODE_SAMPLE  2
+#define XDEBUG_PROFILER_MODE_MEMORY  3 /* merged, but only kept for xdebug_get_profile_summary() */
+#define XDEBUG_PROFILER_MODE_FOLDED  4 /* collapsed stacks, for flame graphs */
+
+#define XDEBUG_PROFILER_SQL_NONE      0
+#define XDEBUG_PROFILER_SQL_ARGUMENT  1 /* PDO::query(), PDO::exec() */
+#define XDEBUG_PROFILER_SQL_STATEMENT 2 /* PDOStatement::execute(), its queryString */
+
+/* The events written to cachegrind files: time in nanoseconds, the change
+ * in memory usage and in peak memory usage in bytes, and, with
+ * xdebug.profiler_cpu_time, the CPU time of the thread in nanoseconds */
+typedef struct _xdebug_profiler_cost {
+	xdebug_nanotime time;
+	long            memory;
+	long            peak_memory;
+	xdebug_nanotime cpu;
+} xdebug_profiler_cost;
+
+#define XDEBUG_PROFILER_COST_ADD(a, b) { \
+	(a).time += (b).time; \
+	(a).memory += (b).memory; \
+	(a).peak_memory += (b).peak_memory; \
+	(a).cpu += (b).cpu; \
+}
+
+#define XDEBUG_PROFILER_COST_SUB(a, b) { \
+	(a).time -= (b).time; \
+	(a).memory -= (b).memory; \
+	(a).peak_memory -= (b).peak_memory; \
+	(a).cpu -= (b).cpu; \
+}
+
+/* Per request profiler tables. Every file and function that shows up in a
+ * profile gets one record with an owned copy of its name and a small
+ * integer id, which is what the cachegrind name compression refers to. */
+typedef struct _xdebug_profiler_file {
+	long        id;
+	char       *name;
+	int         written;
+
+	/* what loading the file cost: the time spent compiling it, running its
+	 * top level code (inclusive), and in the autoloader call that loaded
+	 * it, if any */
+	xdebug_nanotime compile_time;
+	xdebug_nanotime execute_time;
+	xdebug_nanotime autoload_time;
+	long            size; /* -1 if unknown */
+	unsigned long   compile_count;
+	unsigned long   include_count;
+} xdebug_profiler_file;
+
+typedef struct _xdebug_profiler_edge xdebug_profiler_edge;
+
+typedef struct _xdebug_profiler_function {
+	long                  id;
+	char                 *name;
+	xdebug_profiler_file *file;
+	int                   lineno;
+	int                   is_main;
+	int                   is_internal; /* named with the cachegrind "php::" prefix */
+	int                   written;
+	int                   included; /* passes xdebug.profiler_include and _exclude */
+	int                   is_file;  /* the main script, or an include or require */
+	int                   is_autoload; /* spl_autoload_call() or __autoload() */
+	int                   category; /* index in xdebug.profiler_categories, or -1 */
+	int                   sql;      /* XDEBUG_PROFILER_SQL_*, where its statement is */
+	int                   line_count; /* lines costed, from lineno on, with xdebug.profiler_lines */
+	xdebug_nanotime      *line_times; /* own time per line, only kept in merged mode */
+
+	/* totals, only kept in merged mode */
+	unsigned long         call_count;
+	xdebug_profiler_cost  cost_own;
+	xdebug_profiler_cost  cost_inclusive;
+	xdebug_profiler_edge *edges;
+	xdebug_profiler_edge *edges_tail;
+} xdebug_profiler_function;
+
+struct _xdebug_profiler_edge {
+	xdebug_profiler_function *callee;
+	int                       lineno;
+	unsigned long             call_count;
+	xdebug_profiler_cost      cost_inclusive;
+	xdebug_profiler_edge     *next;
+};
+
+/* A node of the stack trie used for folded output: a function, as called
+ * with the stack that leads up to its parent node */
+typedef struct _xdebug_profiler_stack_node {
+	xdebug_profiler_function *func;
+	long                      parent; /* -1 for a root */
+	xdebug_nanotime           time;   /* own time spent with exactly this stack */
+} xdebug_profiler_stack_node;
+
 typedef struct _xdebug_call_entry {
 	int         type; /* 0 = function call, 1 = line */
-	int         user_defined;
-	char       *filename;
-	char       *function;
+	xdebug_profiler_function *func;
 	int         lineno;
-	double      time_taken;
+	xdebug_profiler_cost cost;
+	struct _xdebug_call_entry *next;
 } xdebug_call_entry;
 
 typedef struct xdebug_aggregate_entry {
@@ -144,16 +239,41 @@ typedef struct xdebug_aggregate_entry {
 	char       *function;
 	int         lineno;
 	int         call_count;
-	double      time_own;
-	double      time_inclusive;
+	xdebug_profiler_cost cost_own;
+	xdebug_profiler_cost cost_inclusive;
 	HashTable  *call_list;
 } xdebug_aggregate_entry;
 
+/* The aggregate entry, and the last caller it was linked to, for one call
+ * site (a call from one function or method to another) */
+typedef struct xdebug_aggregate_site {
+	xdebug_aggregate_entry *entry;
+	unsigned int            slot;
+	xdebug_aggregate_entry *edge_caller;
+	unsigned int            edge_caller_slot;
+	unsigned int            edge_slot;
+} xdebug_aggregate_site;
+
 typedef struct xdebug_profile {
-	double        time;
-	double        mark;
-	long          memory;
-	xdebug_llist *call_list;
+	xdebug_nanotime time;
+	xdebug_nanotime mark;
+	long          memory_mark;
+	long          peak_memory_mark;
+	xdebug_nanotime cpu_mark;
+	xdebug_profiler_cost cost;     /* inclusive, set when the function ends */
+	xdebug_profiler_cost children;
+	xdebug_call_entry *call_list; /* calls made, until this function's record is written */
+	xdebug_call_entry *call_list_tail;
+	xdebug_profiler_function *func;
+	struct _function_stack_entry *parent; /* nearest included caller */
+	int           call_lineno;            /* line in parent the call was made from */
+	long          stack_node;             /* in folded mode, -1 otherwise */
+	struct _xdebug_profiler_file *autoload_saved; /* outer autoload's file, for autoload calls */
+	struct _zval_struct *sql;             /* statement run by a PDO call, with xdebug.profiler_sql */
+	xdebug_nanotime *line_times;          /* own time per line, with xdebug.profiler_lines */
+	int           line;                   /* line being run */
+	xdebug_nanotime line_mark;            /* when it started running */
+	xdebug_nanotime line_children;        /* children.time at line_mark */
 } xdebug_profile;
 
 typedef struct _function_stack_entry {
@@ -180,7 +300,7 @@ typedef struct _function_stack_entry {
 	/* tracing properties */
 	signed long  memory;
 	signed long  prev_memory;
-	double       time;
+	xdebug_nanotime time;
 
 	/* profiling properties */
 	xdebug_profile profile;
@@ -194,6 +314,8 @@ typedef struct _function_stack_entry {
 	struct _function_stack_entry *prev;
 	zend_op_array *op_array;
 	xdebug_aggregate_entry *aggr_entry;
+	unsigned int  aggr_slot; /* slot in the shared aggregate, 0 if none */
+	unsigned int  aggr_edge_slot; /* slot of the edge from the caller's */
 } function_stack_entry;
 
 function_stack_entry *xdebug_get_stack_head(TSRMLS_D);
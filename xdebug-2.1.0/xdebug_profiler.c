@@ -16,20 +16,37 @@
    +----------------------------------------------------------------------+
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "php.h"
 #include "TSRM.h"
 #include "php_globals.h"
 #include "php_xdebug.h"
 #include "Zend/zend_alloc.h"
+#include "xdebug_file.h"
 #include "xdebug_mm.h"
 #include "xdebug_profiler.h"
 #include "xdebug_str.h"
 #include "xdebug_var.h"
 #include "usefulstuff.h"
+#include <ctype.h>
 #ifdef PHP_WIN32
 #include <process.h>
 #endif
 
+/* The sampling timer thread is per process, so sampling is not available
+ * in threaded builds */
+#if defined(HAVE_CLOCK_NANOSLEEP) && defined(HAVE_XDEBUG_PTHREAD) && !defined(ZTS)
+# define XDEBUG_PROFILER_SAMPLING 1
+# include <errno.h>
+# include <pthread.h>
+# include <time.h>
+#endif
+
+xdebug_aggr_shm *xdebug_aggr_shared = NULL;
+
 ZEND_EXTERN_MODULE_GLOBALS(xdebug)
 
 void xdebug_profile_aggr_call_entry_dtor(void *elem)
@@ -43,105 +60,1595 @@ void xdebug_profile_aggr_call_entry_dtor(void *elem)
 	}
 }
 
-void xdebug_profile_call_entry_dtor(void *dummy, void *elem)
+/* Call entries are only needed until their caller has written its record,
+ * so instead of allocating them one by one they are cut from large blocks and
+ * recycled through a free list. The blocks are only released when the
+ * profile is closed. */
+#define XDEBUG_PROFILER_CALL_BLOCK_SIZE 1024
+
+typedef struct _xdebug_profiler_call_block {
+	struct _xdebug_profiler_call_block *next;
+	xdebug_call_entry                   entries[XDEBUG_PROFILER_CALL_BLOCK_SIZE];
+} xdebug_profiler_call_block;
+
+static xdebug_call_entry *xdebug_profiler_call_entry_alloc(TSRMLS_D)
+{
+	xdebug_call_entry          *ce;
+	xdebug_profiler_call_block *block;
+
+	if (XG(profile_call_free)) {
+		ce = XG(profile_call_free);
+		XG(profile_call_free) = ce->next;
+		return ce;
+	}
+
+	if (!XG(profile_call_blocks) || XG(profile_call_block_used) == XDEBUG_PROFILER_CALL_BLOCK_SIZE) {
+		block = xdmalloc(sizeof(xdebug_profiler_call_block));
+		block->next = XG(profile_call_blocks);
+		XG(profile_call_blocks) = block;
+		XG(profile_call_block_used) = 0;
+	}
+	return &XG(profile_call_blocks)->entries[XG(profile_call_block_used)++];
+}
+
+/* Hands all of a function's call entries back in one go */
+static void xdebug_profiler_call_list_release(function_stack_entry *fse TSRMLS_DC)
+{
+	if (fse->profile.call_list) {
+		fse->profile.call_list_tail->next = XG(profile_call_free);
+		XG(profile_call_free) = fse->profile.call_list;
+		fse->profile.call_list = NULL;
+		fse->profile.call_list_tail = NULL;
+	}
+}
+
+static void xdebug_profiler_file_dtor(void *elem)
+{
+	xdebug_profiler_file *file = *(xdebug_profiler_file **) elem;
+
+	xdfree(file->name);
+	xdfree(file);
+}
+
+/* xdebug.profiler_include and xdebug.profiler_exclude are comma separated
+ * lists of patterns. A pattern with a "/" in it is matched against the file
+ * a function is defined in: from the start of the path when it begins with a
+ * "/", and from the start of any path element otherwise. Other patterns are
+ * matched against the start of "class::method", or of the function name. A
+ * "*" matches any run of characters. */
+typedef struct _xdebug_profiler_filter {
+	int    count;
+	char **patterns;
+} xdebug_profiler_filter;
+
+static xdebug_profiler_filter *xdebug_profiler_filter_compile(char *list)
+{
+	xdebug_profiler_filter *filter;
+	char                   *start, *end;
+
+	if (!list || !*list) {
+		return NULL;
+	}
+
+	filter = xdmalloc(sizeof(xdebug_profiler_filter));
+	filter->count = 0;
+	filter->patterns = NULL;
+
+	while (*list) {
+		while (*list == ' ' || *list == ',') {
+			list++;
+		}
+		start = list;
+		while (*list && *list != ',') {
+			list++;
+		}
+		end = list;
+		while (end > start && end[-1] == ' ') {
+			end--;
+		}
+		if (end > start) {
+			filter->patterns = xdrealloc(filter->patterns, (filter->count + 1) * sizeof(char *));
+			filter->patterns[filter->count++] = xdstrndup(start, end - start);
+		}
+	}
+
+	if (!filter->count) {
+		xdfree(filter);
+		return NULL;
+	}
+	return filter;
+}
+
+static void xdebug_profiler_filter_free(xdebug_profiler_filter *filter)
+{
+	int i;
+
+	if (!filter) {
+		return;
+	}
+	for (i = 0; i < filter->count; i++) {
+		xdfree(filter->patterns[i]);
+	}
+	xdfree(filter->patterns);
+	xdfree(filter);
+}
+
+/* Matches pattern against the start of str */
+static int xdebug_profiler_pattern_match(const char *pattern, const char *str)
+{
+	while (*pattern) {
+		if (*pattern == '*') {
+			pattern++;
+			do {
+				if (xdebug_profiler_pattern_match(pattern, str)) {
+					return 1;
+				}
+			} while (*str++);
+			return 0;
+		}
+		if (*pattern != *str) {
+			return 0;
+		}
+		pattern++;
+		str++;
+	}
+	return 1;
+}
+
+static int xdebug_profiler_filter_match(xdebug_profiler_filter *filter, char *name, char *filename)
+{
+	int   i;
+	char *pattern, *element;
+
+	for (i = 0; i < filter->count; i++) {
+		pattern = filter->patterns[i];
+
+		if (!strchr(pattern, '/')) {
+			if (name && xdebug_profiler_pattern_match(pattern, name)) {
+				return 1;
+			}
+		} else if (pattern[0] == '/') {
+			if (xdebug_profiler_pattern_match(pattern, filename)) {
+				return 1;
+			}
+		} else {
+			for (element = filename; element; element = strchr(element, '/')) {
+				if (*element == '/') {
+					element++;
+				}
+				if (xdebug_profiler_pattern_match(pattern, element)) {
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* The name filters and categories match against: "class::method" or
+ * "function", or NULL for includes and the like */
+static char *xdebug_profiler_filter_name(function_stack_entry *fse)
+{
+	if (!XDEBUG_IS_FUNCTION(fse->function.type)) {
+		return NULL;
+	}
+	if (fse->function.class) {
+		return xdebug_sprintf("%s::%s", fse->function.class, fse->function.function);
+	}
+	return xdstrdup(fse->function.function);
+}
+
+/* xdebug.profiler_categories is a ";" separated list of "category=patterns"
+ * entries, where patterns is a list like xdebug.profiler_include's. The time
+ * spent in internal functions matching a category's patterns is added up per
+ * category; calls made from within such a function count for the outer one
+ * only. */
+typedef struct _xdebug_profiler_category {
+	char                   *name;
+	xdebug_profiler_filter *filter;
+	xdebug_nanotime         time;
+	unsigned long           calls;
+} xdebug_profiler_category;
+
+static void xdebug_profiler_categories_compile(char *map TSRMLS_DC)
+{
+	xdebug_profiler_category *category;
+	char                     *end, *eq, *list;
+
+	XG(profile_categories) = NULL;
+	XG(profile_category_count) = 0;
+	XG(profile_category_depth) = 0;
+
+	while (map && *map) {
+		while (*map == ' ' || *map == ';') {
+			map++;
+		}
+		end = strchr(map, ';');
+		if (!end) {
+			end = map + strlen(map);
+		}
+		eq = memchr(map, '=', end - map);
+		if (eq && eq > map) {
+			list = xdstrndup(eq + 1, end - eq - 1);
+			XG(profile_categories) = xdrealloc(XG(profile_categories), (XG(profile_category_count) + 1) * sizeof(xdebug_profiler_category));
+			category = &XG(profile_categories)[XG(profile_category_count)];
+			category->filter = xdebug_profiler_filter_compile(list);
+			xdfree(list);
+			if (category->filter) {
+				while (eq > map && eq[-1] == ' ') {
+					eq--;
+				}
+				category->name = xdstrndup(map, eq - map);
+				category->time = 0;
+				category->calls = 0;
+				XG(profile_category_count)++;
+			}
+		}
+		map = end;
+	}
+}
+
+static void xdebug_profiler_categories_free(TSRMLS_D)
+{
+	int i;
+
+	for (i = 0; i < XG(profile_category_count); i++) {
+		xdfree(XG(profile_categories)[i].name);
+		xdebug_profiler_filter_free(XG(profile_categories)[i].filter);
+	}
+	if (XG(profile_categories)) {
+		xdfree(XG(profile_categories));
+	}
+	XG(profile_categories) = NULL;
+	XG(profile_category_count) = 0;
+}
+
+/* The first category an internal function's name matches, or -1 */
+static int xdebug_profiler_category_of(char *name TSRMLS_DC)
+{
+	int i;
+
+	for (i = 0; name && i < XG(profile_category_count); i++) {
+		if (xdebug_profiler_filter_match(XG(profile_categories)[i].filter, name, "php:internal")) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* With xdebug.profiler_sql the statements run through PDO, and the
+ * functions in xdebug.profiler_query_functions, are aggregated by their
+ * text, with the literals taken out, so that the time spent in PDO::query()
+ * and PDOStatement::execute() can be broken down by query. The repeated
+ * query detector works on the same normalized statements. */
+#define XDEBUG_PROFILER_SQL_MAX_LEN 4096
+
+/* Statements are normalized once per distinct text as run, and that text is
+ * remembered for up to this many statements; queries with their values
+ * written into them are normalized every time once the cache is full */
+#define XDEBUG_PROFILER_SQL_CACHE_SIZE 1024
+#define XDEBUG_PROFILER_SQL_ENABLED() (XG(profiler_sql) || XG(profiler_repeat_threshold) > 0)
+
+typedef struct _xdebug_profiler_sql {
+	char            *sql;
+	unsigned long    count;
+	xdebug_nanotime  time;
+	xdebug_nanotime  max_time;
+} xdebug_profiler_sql;
+
+static void xdebug_profiler_sql_dtor(void *elem)
+{
+	xdebug_profiler_sql *sql = *(xdebug_profiler_sql **) elem;
+
+	xdfree(sql->sql);
+	xdfree(sql);
+}
+
+/* Where an internal function, by its filter name, finds the statement it
+ * runs */
+static int xdebug_profiler_sql_source(char *name TSRMLS_DC)
+{
+	if (!name || !XDEBUG_PROFILER_SQL_ENABLED()) {
+		return XDEBUG_PROFILER_SQL_NONE;
+	}
+	if (strcmp(name, "PDO::query") == 0 || strcmp(name, "PDO::exec") == 0) {
+		return XDEBUG_PROFILER_SQL_ARGUMENT;
+	}
+	if (strcmp(name, "PDOStatement::execute") == 0) {
+		return XDEBUG_PROFILER_SQL_STATEMENT;
+	}
+	if (XG(profile_query_functions) && xdebug_profiler_filter_match(XG(profile_query_functions), name, "php:internal")) {
+		return XDEBUG_PROFILER_SQL_ARGUMENT;
+	}
+	return XDEBUG_PROFILER_SQL_NONE;
+}
+
+#define XDEBUG_SQL_IS_IDENT(c) (isalnum((unsigned char) (c)) || (c) == '_' || (c) == '$')
+
+/* Appends a "?" to the normalized statement, unless it would only continue
+ * a list of them: "IN (1, 2, 3)" becomes "IN (?)" */
+static char *xdebug_profiler_sql_placeholder(char *out, char *o)
+{
+	char *q = o;
+
+	while (q > out && q[-1] == ' ') {
+		q--;
+	}
+	if (q > out && q[-1] == ',') {
+		q--;
+		while (q > out && q[-1] == ' ') {
+			q--;
+		}
+		if (q > out && q[-1] == '?') {
+			return q;
+		}
+	}
+	*o++ = '?';
+	return o;
+}
+
+/* Replaces string and number literals with "?" and squeezes whitespace. Double
+ * quotes are left alone, as they are identifiers in standard SQL. */
+static char *xdebug_profiler_sql_normalize(const char *sql, int len)
+{
+	const char *p = sql, *end;
+	char       *out, *o;
+
+	if (len > XDEBUG_PROFILER_SQL_MAX_LEN) {
+		len = XDEBUG_PROFILER_SQL_MAX_LEN;
+	}
+	end = sql + len;
+	out = o = xdmalloc(len + 1);
+
+	while (p < end) {
+		if (*p == '\'') {
+			for (p++; p < end; p++) {
+				if (*p == '\\' && p + 1 < end) {
+					p++;
+				} else if (*p == '\'') {
+					if (p + 1 < end && p[1] == '\'') {
+						p++;
+					} else {
+						p++;
+						break;
+					}
+				}
+			}
+			o = xdebug_profiler_sql_placeholder(out, o);
+		} else if (isdigit((unsigned char) *p) && (p == sql || !XDEBUG_SQL_IS_IDENT(p[-1]))) {
+			while (p < end && (XDEBUG_SQL_IS_IDENT(*p) || *p == '.')) {
+				p++;
+			}
+			o = xdebug_profiler_sql_placeholder(out, o);
+		} else if (*p == '?') {
+			p++;
+			o = xdebug_profiler_sql_placeholder(out, o);
+		} else if (isspace((unsigned char) *p)) {
+			while (p < end && isspace((unsigned char) *p)) {
+				p++;
+			}
+			if (o > out && p < end) {
+				*o++ = ' ';
+			}
+		} else {
+			*o++ = *p++;
+		}
+	}
+	*o = '\0';
+
+	return out;
+}
+
+static xdebug_profiler_sql *xdebug_profiler_sql_add(zval *statement, xdebug_nanotime time TSRMLS_DC)
+{
+	xdebug_profiler_sql **psql, *sql;
+	char                 *text;
+	int                   len, raw_len;
+
+	if (Z_TYPE_P(statement) != IS_STRING) {
+		return NULL;
+	}
+
+	/* Only the part that is normalized matters, so that is the key */
+	raw_len = Z_STRLEN_P(statement) < XDEBUG_PROFILER_SQL_MAX_LEN ? Z_STRLEN_P(statement) : XDEBUG_PROFILER_SQL_MAX_LEN;
+	if (raw_len && zend_hash_find(XG(profile_sql_cache), Z_STRVAL_P(statement), raw_len, (void **) &psql) == SUCCESS) {
+		sql = *psql;
+	} else {
+		text = xdebug_profiler_sql_normalize(Z_STRVAL_P(statement), raw_len);
+		len = strlen(text) + 1;
+		if (zend_hash_find(XG(profile_sql), text, len, (void **) &psql) == SUCCESS) {
+			sql = *psql;
+			xdfree(text);
+		} else {
+			sql = xdmalloc(sizeof(xdebug_profiler_sql));
+			sql->sql = text;
+			sql->count = 0;
+			sql->time = 0;
+			sql->max_time = 0;
+			zend_hash_add(XG(profile_sql), text, len, (void *) &sql, sizeof(xdebug_profiler_sql *), NULL);
+		}
+		if (raw_len && zend_hash_num_elements(XG(profile_sql_cache)) < XDEBUG_PROFILER_SQL_CACHE_SIZE) {
+			zend_hash_add(XG(profile_sql_cache), Z_STRVAL_P(statement), raw_len, (void *) &sql, sizeof(xdebug_profiler_sql *), NULL);
+		}
+	}
+
+	sql->count++;
+	sql->time += time;
+	if (time > sql->max_time) {
+		sql->max_time = time;
+	}
+
+	return sql;
+}
+
+/* xdebug.profiler_repeat_threshold: the same statement, run from the same
+ * line of the same function that many times or more in one request, is
+ * most likely a query in a loop that should have been a single one. The
+ * call site is that of the nearest included caller, so excluding a
+ * database library with xdebug.profiler_exclude moves it into the
+ * application's code. */
+typedef struct _xdebug_profiler_repeat_key {
+	xdebug_profiler_sql      *sql;
+	xdebug_profiler_function *caller;
+	long                      lineno;
+} xdebug_profiler_repeat_key;
+
+typedef struct _xdebug_profiler_repeat {
+	xdebug_profiler_repeat_key key;
+	unsigned long              count;
+	xdebug_nanotime            time;
+} xdebug_profiler_repeat;
+
+static void xdebug_profiler_repeat_add(xdebug_profiler_sql *sql, function_stack_entry *fse TSRMLS_DC)
+{
+	xdebug_profiler_repeat_key  key;
+	xdebug_profiler_repeat     *repeat, new_repeat;
+
+	/* The key is hashed as raw bytes, padding included */
+	memset(&key, 0, sizeof(key));
+	key.sql = sql;
+	key.caller = fse->profile.parent ? fse->profile.parent->profile.func : NULL;
+	key.lineno = fse->profile.call_lineno;
+
+	if (zend_hash_find(XG(profile_repeats), (char *) &key, sizeof(key), (void **) &repeat) == SUCCESS) {
+		repeat->count++;
+		repeat->time += fse->profile.cost.time;
+		return;
+	}
+
+	new_repeat.key = key;
+	new_repeat.count = 1;
+	new_repeat.time = fse->profile.cost.time;
+	zend_hash_add(XG(profile_repeats), (char *) &key, sizeof(key), (void *) &new_repeat, sizeof(xdebug_profiler_repeat), NULL);
+}
+
+static int xdebug_profiler_sql_cmp(const void *a, const void *b TSRMLS_DC)
+{
+	xdebug_profiler_sql *sa = *(xdebug_profiler_sql **) (*(Bucket **) a)->pData;
+	xdebug_profiler_sql *sb = *(xdebug_profiler_sql **) (*(Bucket **) b)->pData;
+
+	return sa->time < sb->time ? 1 : (sa->time > sb->time ? -1 : 0);
+}
+
+static int xdebug_profiler_is_included(function_stack_entry *fse, xdebug_profiler_function *func TSRMLS_DC)
+{
+	char *name = NULL;
+	int   included;
+
+	/* There always has to be a record to fold excluded calls into */
+	if (func->is_main || (!XG(profile_include) && !XG(profile_exclude))) {
+		return 1;
+	}
+
+	name = xdebug_profiler_filter_name(fse);
+
+	included =
+		(!XG(profile_include) || xdebug_profiler_filter_match(XG(profile_include), name, func->file->name)) &&
+		(!XG(profile_exclude) || !xdebug_profiler_filter_match(XG(profile_exclude), name, func->file->name));
+
+	if (name) {
+		xdfree(name);
+	}
+	return included;
+}
+
+/* Functions and methods stay in the function tables until the end of the
+ * request, so their records can be found by address. The call type is part
+ * of the key because it decides between "->" and "::" in the name. */
+#define XDEBUG_PROFILER_CACHE_KEY(zf, type) ((((ulong) (zend_uintptr_t) (zf)) >> 3) * 4 + (type))
+
+static xdebug_profiler_file *xdebug_profiler_get_file(char *filename TSRMLS_DC)
+{
+	xdebug_profiler_file **pfile, *file;
+	int                    len = strlen(filename) + 1;
+
+	if (zend_hash_find(XG(profile_filenames), filename, len, (void **) &pfile) == SUCCESS) {
+		return *pfile;
+	}
+
+	file = xdmalloc(sizeof(xdebug_profiler_file));
+	file->id = ++XG(profile_last_filename_ref);
+	file->name = xdstrdup(filename);
+	file->written = 0;
+	file->compile_time = 0;
+	file->execute_time = 0;
+	file->autoload_time = 0;
+	file->size = -1;
+	file->compile_count = 0;
+	file->include_count = 0;
+	zend_hash_add(XG(profile_filenames), filename, len, (void *) &file, sizeof(xdebug_profiler_file *), NULL);
+
+	return file;
+}
+
+/* Whether the function has no name of its own, so that every one of its
+ * kind gets the same profiler record */
+static int xdebug_profiler_is_anonymous(function_stack_entry *fse)
+{
+#ifdef ZEND_ACC_CLOSURE
+	if (fse->op_array && (fse->op_array->fn_flags & ZEND_ACC_CLOSURE)) {
+		return 1;
+	}
+#endif
+	return fse->function.function && (
+		strcmp(fse->function.function, "{closure}") == 0 ||
+		strcmp(fse->function.function, "__lambda_func") == 0
+	);
+}
+
+static xdebug_profiler_function *xdebug_profiler_get_function(function_stack_entry *fse, zend_function *zfunc TSRMLS_DC)
+{
+	xdebug_profiler_function **pfunc, *func;
+	char                      *tmp_name, *tmp_fname;
+	ulong                      cache_key = 0;
+
+	/* File level op_arrays (includes, evals and the main script) have no
+	 * function name. They, and closures, can be destroyed during the request
+	 * after which their address might be reused, so those are always looked
+	 * up by name */
+	if (zfunc && zfunc->common.function_name && XDEBUG_IS_FUNCTION(fse->function.type)
+#ifdef ZEND_ACC_CLOSURE
+		&& !(zfunc->common.fn_flags & ZEND_ACC_CLOSURE)
+#endif
+	) {
+		cache_key = XDEBUG_PROFILER_CACHE_KEY(zfunc, fse->function.type);
+		if (zend_hash_index_find(XG(profile_function_cache), cache_key, (void **) &pfunc) == SUCCESS) {
+			return *pfunc;
+		}
+	}
+
+	tmp_name = xdebug_show_fname(fse->function, 0, 0 TSRMLS_CC);
+	switch (fse->function.type) {
+		case XFUNC_INCLUDE:
+		case XFUNC_INCLUDE_ONCE:
+		case XFUNC_REQUIRE:
+		case XFUNC_REQUIRE_ONCE:
+			tmp_fname = xdebug_sprintf("%s::%s", tmp_name, fse->include_filename);
+			xdfree(tmp_name);
+			tmp_name = tmp_fname;
+			break;
+	}
+	if (fse->user_defined == XDEBUG_INTERNAL) {
+		tmp_fname = xdebug_sprintf("php::%s", tmp_name);
+		xdfree(tmp_name);
+		tmp_name = tmp_fname;
+	}
+
+	if (zend_hash_find(XG(profile_function_names), tmp_name, strlen(tmp_name) + 1, (void **) &pfunc) == SUCCESS) {
+		func = *pfunc;
+		xdfree(tmp_name);
+	} else {
+		func = xdcalloc(1, sizeof(xdebug_profiler_function));
+		func->id = XG(profile_function_count) + 1;
+		func->name = tmp_name;
+		func->is_main = fse->function.function && strcmp(fse->function.function, "{main}") == 0;
+		func->is_internal = fse->user_defined == XDEBUG_INTERNAL;
+		func->is_file = func->is_main || (fse->function.type & XFUNC_INCLUDES && fse->function.type != XFUNC_EVAL);
+		func->is_autoload = fse->function.type == XFUNC_NORMAL && !fse->function.class && (
+			(fse->user_defined == XDEBUG_INTERNAL && strcmp(fse->function.function, "spl_autoload_call") == 0) ||
+			(fse->user_defined == XDEBUG_EXTERNAL && strcmp(fse->function.function, "__autoload") == 0)
+		);
+
+		if (fse->user_defined == XDEBUG_EXTERNAL) {
+			func->file = xdebug_profiler_get_file(fse->op_array->filename TSRMLS_CC);
+			func->lineno = (fse->function.type & XFUNC_INCLUDES) || func->is_main ? 1 : fse->op_array->line_start;
+		} else {
+			func->file = xdebug_profiler_get_file("php:internal" TSRMLS_CC);
+			func->lineno = 0;
+		}
+
+		if (XG(profile_function_count) == XG(profile_function_size)) {
+			XG(profile_function_size) = XG(profile_function_size) ? XG(profile_function_size) * 2 : 256;
+			XG(profile_functions) = xdrealloc(XG(profile_functions), XG(profile_function_size) * sizeof(xdebug_profiler_function *));
+		}
+		func->included = xdebug_profiler_is_included(fse, func TSRMLS_CC);
+		func->category = -1;
+		func->sql = XDEBUG_PROFILER_SQL_NONE;
+		func->line_count = 0;
+		/* The line table follows the lines of the function this record was
+		 * made for, so it can't be shared by the closures (and
+		 * create_function() lambdas) that all end up in one record */
+		if (
+			fse->user_defined == XDEBUG_EXTERNAL && func->included && XG(profile_lines) &&
+			XDEBUG_IS_FUNCTION(fse->function.type) && fse->op_array->line_end >= fse->op_array->line_start &&
+			!xdebug_profiler_is_anonymous(fse)
+		) {
+			char *name = xdebug_profiler_filter_name(fse);
+
+			if (xdebug_profiler_filter_match(XG(profile_lines), name, func->file->name)) {
+				func->line_count = fse->op_array->line_end - fse->op_array->line_start + 1;
+			}
+			xdfree(name);
+		}
+		if (fse->user_defined == XDEBUG_INTERNAL && (XG(profile_category_count) || XDEBUG_PROFILER_SQL_ENABLED())) {
+			char *name = xdebug_profiler_filter_name(fse);
+
+			func->category = xdebug_profiler_category_of(name TSRMLS_CC);
+			func->sql = xdebug_profiler_sql_source(name TSRMLS_CC);
+			if (name) {
+				xdfree(name);
+			}
+		}
+
+		XG(profile_functions)[XG(profile_function_count)++] = func;
+		zend_hash_add(XG(profile_function_names), func->name, strlen(func->name) + 1, (void *) &func, sizeof(xdebug_profiler_function *), NULL);
+	}
+
+	if (cache_key) {
+		zend_hash_index_update(XG(profile_function_cache), cache_key, (void *) &func, sizeof(xdebug_profiler_function *), NULL);
+	}
+
+	return func;
+}
+
+/* xdebug.profiler_max_overhead is not judged on less than this much run
+ * time, as the first few records say little about the rest */
+#define XDEBUG_PROFILER_OVERHEAD_WARMUP ((xdebug_nanotime) 10 * NANOS_IN_SEC / 1000)
+
+/* The writing of one in this many records is timed for
+ * xdebug.profiler_max_overhead */
+#define XDEBUG_PROFILER_OVERHEAD_INTERVAL 64
+
+/* Cachegrind costs are unsigned counters, so a net change in memory usage is
+ * written as what it grew by and what it shrank by; their difference still
+ * adds up exactly. Peak usage never goes down. */
+#define XDEBUG_PROFILER_MEMORY_GROWN(m)  ((m) > 0 ? (unsigned long) (m) : 0UL)
+#define XDEBUG_PROFILER_MEMORY_SHRUNK(m) ((m) < 0 ? (unsigned long) -(m) : 0UL)
+
+/* The "events:" header; the CPU event is only written with
+ * xdebug.profiler_cpu_time */
+#define XDEBUG_PROFILER_EVENTS (XG(profiler_cpu_time) ? "Time MemoryAllocated MemoryFreed PeakMemory CPU" : "Time MemoryAllocated MemoryFreed PeakMemory")
+
+/* Writes a cost line, with the costs in the order of the "events:" header */
+static void xdebug_profiler_write_cost_line(xdebug_file *file, int lineno, xdebug_profiler_cost *cost TSRMLS_DC)
+{
+	if (XG(profiler_cpu_time)) {
+		xdebug_file_printf(file, "%d %lu %lu %lu %lu %lu\n", lineno,
+			XDEBUG_NANOTIME_TO_MICROS(cost->time), XDEBUG_PROFILER_MEMORY_GROWN(cost->memory), XDEBUG_PROFILER_MEMORY_SHRUNK(cost->memory),
+			XDEBUG_PROFILER_MEMORY_GROWN(cost->peak_memory), XDEBUG_NANOTIME_TO_MICROS(cost->cpu));
+	} else {
+		xdebug_file_printf(file, "%d %lu %lu %lu %lu\n", lineno,
+			XDEBUG_NANOTIME_TO_MICROS(cost->time), XDEBUG_PROFILER_MEMORY_GROWN(cost->memory), XDEBUG_PROFILER_MEMORY_SHRUNK(cost->memory),
+			XDEBUG_PROFILER_MEMORY_GROWN(cost->peak_memory));
+	}
+}
+
+static void xdebug_profiler_write_cost_summary(xdebug_file *file, xdebug_profiler_cost *cost TSRMLS_DC)
+{
+	if (XG(profiler_cpu_time)) {
+		xdebug_file_printf(file, "\nsummary: %lu %lu %lu %lu %lu\n\n",
+			XDEBUG_NANOTIME_TO_MICROS(cost->time), XDEBUG_PROFILER_MEMORY_GROWN(cost->memory), XDEBUG_PROFILER_MEMORY_SHRUNK(cost->memory),
+			XDEBUG_PROFILER_MEMORY_GROWN(cost->peak_memory), XDEBUG_NANOTIME_TO_MICROS(cost->cpu));
+	} else {
+		xdebug_file_printf(file, "\nsummary: %lu %lu %lu %lu\n\n",
+			XDEBUG_NANOTIME_TO_MICROS(cost->time), XDEBUG_PROFILER_MEMORY_GROWN(cost->memory), XDEBUG_PROFILER_MEMORY_SHRUNK(cost->memory),
+			XDEBUG_PROFILER_MEMORY_GROWN(cost->peak_memory));
+	}
+}
+
+/* Cachegrind name compression: the first time a file or function is used in
+ * a profile its name is written as "(id) name", and after that only the
+ * "(id)" is written. */
+static void xdebug_profiler_write_file_ref(char *type, xdebug_profiler_file *file TSRMLS_DC)
+{
+	if (file->written) {
+		xdebug_file_printf(XG(profile_file), "%s=(%ld)\n", type, file->id);
+	} else {
+		xdebug_file_printf(XG(profile_file), "%s=(%ld) %s\n", type, file->id, file->name);
+		file->written = 1;
+	}
+}
+
+static void xdebug_profiler_write_function_ref(char *type, xdebug_profiler_function *func TSRMLS_DC)
+{
+	if (func->written) {
+		xdebug_file_printf(XG(profile_file), "%s=(%ld)\n", type, func->id);
+	} else {
+		xdebug_file_printf(XG(profile_file), "%s=(%ld) %s\n", type, func->id, func->name);
+		func->written = 1;
+	}
+}
+
+static int xdebug_profiler_open_file(char *script_name TSRMLS_DC)
+{
+	char *filename = NULL, *fname = NULL;
+	
+	if (!strlen(XG(profiler_output_name)) ||
+		xdebug_format_output_filename(&fname, XG(profiler_output_name), script_name) <= 0
+	) {
+		/* Invalid or empty xdebug.profiler_output_name */
+		return FAILURE;
+	}
+	filename = xdebug_sprintf("%s/%s", XG(profiler_output_dir), fname);
+	xdfree(fname);
+		
+	if (XG(profiler_append)) {
+		XG(profile_file) = xdebug_file_open(filename, "a", NULL, &XG(profile_filename), XG(profiler_buffer_size), XDEBUG_OUTPUT_OPTIONS());
+	} else {
+		XG(profile_file) = xdebug_file_open(filename, "w", NULL, &XG(profile_filename), XG(profiler_buffer_size), XDEBUG_OUTPUT_OPTIONS());
+	}
+	xdfree(filename);
+
+	if (!XG(profile_file)) {
+		return FAILURE;
+	}
+
+	/* Folded output is nothing but stacks, so tools don't choke on it */
+	if (XG(profiler_mode) == XDEBUG_PROFILER_MODE_FOLDED) {
+		return SUCCESS;
+	}
+	if (XG(profiler_append)) {
+		xdebug_file_printf(XG(profile_file), "\n==== NEW PROFILING FILE ==============================================\n");
+	}
+	xdebug_file_printf(
+		XG(profile_file), "version: 0.9.6\ncmd: %s\npart: 1\n\n%sevents: %s\n\n",
+		script_name, XG(profiler_lines) && *XG(profiler_lines) ? "positions: line\n" : "", XDEBUG_PROFILER_EVENTS
+	);
+
+	return SUCCESS;
+}
+
+int xdebug_profiler_init(char *script_name TSRMLS_DC)
+{
+	/* Memory-only profiles are never written, so there is no file */
+	if (XG(profiler_mode) == XDEBUG_PROFILER_MODE_MEMORY) {
+		XG(profile_file) = NULL;
+	} else if (xdebug_profiler_open_file(script_name TSRMLS_CC) == FAILURE) {
+		return FAILURE;
+	}
+
+	XG(profile_filenames) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_filenames), 64, NULL, xdebug_profiler_file_dtor, 1);
+	XG(profile_function_names) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_function_names), 1024, NULL, NULL, 1);
+	XG(profile_function_cache) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_function_cache), 1024, NULL, NULL, 1);
+	XG(profile_edges) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_edges), 1024, NULL, NULL, 1);
+	XG(profile_functions) = NULL;
+	XG(profile_function_count) = 0;
+	XG(profile_function_size) = 0;
+	XG(profile_last_filename_ref) = 0;
+	XG(profile_stack_nodes) = NULL;
+	XG(profile_stack_node_count) = 0;
+	XG(profile_stack_node_size) = 0;
+	XG(profile_stack_children) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_stack_children), 1024, NULL, NULL, 1);
+	XG(profile_sql) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_sql), 64, NULL, xdebug_profiler_sql_dtor, 1);
+	XG(profile_sql_cache) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_sql_cache), 64, NULL, NULL, 1);
+	XG(profile_repeats) = xdmalloc(sizeof(HashTable));
+	zend_hash_init(XG(profile_repeats), 64, NULL, NULL, 1);
+	XG(profile_call_blocks) = NULL;
+	XG(profile_call_block_used) = 0;
+	XG(profile_call_free) = NULL;
+	XG(profile_mode) = XG(profiler_mode);
+	XG(profile_budget) = XG(profiler_max_output) > 0 || XG(profiler_max_overhead) > 0;
+	XG(profile_start_time) = xdebug_get_nanotime();
+	XG(profile_overhead) = 0;
+	XG(profile_overhead_samples) = 0;
+	XG(profile_records) = 0;
+	XG(profile_budget_countdown) = XDEBUG_PROFILER_OVERHEAD_INTERVAL;
+	XG(profile_include) = xdebug_profiler_filter_compile(XG(profiler_include));
+	XG(profile_exclude) = xdebug_profiler_filter_compile(XG(profiler_exclude));
+	XG(profile_query_functions) = xdebug_profiler_filter_compile(XG(profiler_query_functions));
+	XG(profile_lines) = xdebug_profiler_filter_compile(XG(profiler_lines));
+	XG(profile_autoload_depth) = 0;
+	XG(profile_autoload_file) = NULL;
+	xdebug_profiler_categories_compile(XG(profiler_categories) TSRMLS_CC);
+
+	return SUCCESS;
+}
+
+void xdebug_profiler_deinit(TSRMLS_D)
+{
+	function_stack_entry *fse;
+	xdebug_llist_element *le;
+
+	for (le = XDEBUG_LLIST_TAIL(XG(stack)); le != NULL; le = XDEBUG_LLIST_PREV(le)) {
+		fse = XDEBUG_LLIST_VALP(le);
+		if (fse->user_defined == XDEBUG_INTERNAL) {
+			xdebug_profiler_function_internal_end(fse TSRMLS_CC);
+		} else {
+			xdebug_profiler_function_user_end(fse, fse->op_array TSRMLS_CC);
+		}
+	}
+	if (XG(profile_file)) {
+		xdebug_file_flush(XG(profile_file));
+	}
+}
+
+/* Writes a function's own cost: with xdebug.profiler_lines, the time of each
+ * of its lines on a cost line of its own, and whatever is left, including
+ * all of the memory cost, at lineno */
+static void xdebug_profiler_write_own_cost(int lineno, xdebug_profiler_cost *cost, xdebug_profiler_function *func, xdebug_nanotime *line_times TSRMLS_DC)
+{
+	xdebug_profiler_cost rest = *cost, line_cost;
+	int                  i;
+
+	if (line_times) {
+		memset(&line_cost, 0, sizeof(xdebug_profiler_cost));
+		for (i = 0; i < func->line_count; i++) {
+			if (!line_times[i]) {
+				continue;
+			}
+			line_cost.time = line_times[i] < rest.time ? line_times[i] : rest.time;
+			rest.time -= line_cost.time;
+			xdebug_profiler_write_cost_line(XG(profile_file), func->lineno + i, &line_cost TSRMLS_CC);
+		}
+	}
+	xdebug_profiler_write_cost_line(XG(profile_file), lineno, &rest TSRMLS_CC);
+}
+
+/* Writes one record per function, with the calls it made folded into one
+ * entry per callee and call site */
+static void xdebug_profiler_write_merged(TSRMLS_D)
+{
+	xdebug_profiler_function *func;
+	xdebug_profiler_edge     *edge;
+	long                      i;
+
+	for (i = 0; i < XG(profile_function_count); i++) {
+		func = XG(profile_functions)[i];
+		if (!func->call_count) {
+			continue;
+		}
+
+		xdebug_profiler_write_file_ref("fl", func->file TSRMLS_CC);
+		xdebug_profiler_write_function_ref("fn", func TSRMLS_CC);
+		if (func->is_main) {
+			xdebug_profiler_write_cost_summary(XG(profile_file), &func->cost_inclusive TSRMLS_CC);
+		}
+		xdebug_profiler_write_own_cost(func->lineno, &func->cost_own, func, func->line_times TSRMLS_CC);
+
+		for (edge = func->edges; edge != NULL; edge = edge->next) {
+			xdebug_profiler_write_function_ref("cfn", edge->callee TSRMLS_CC);
+			xdebug_file_printf(XG(profile_file), "calls=%lu 0 0\n", edge->call_count);
+			xdebug_profiler_write_cost_line(XG(profile_file), edge->lineno, &edge->cost_inclusive TSRMLS_CC);
+		}
+		xdebug_file_printf(XG(profile_file), "\n");
+	}
+}
+
+/* Writes the costs of loading each file as comments at the end of a
+ * cachegrind file, as there is no place for them in the format itself */
+static void xdebug_profiler_write_files(TSRMLS_D)
+{
+	xdebug_profiler_file **pfile, *file;
+	HashPosition           pos;
+
+	zend_hash_internal_pointer_reset_ex(XG(profile_filenames), &pos);
+	while (zend_hash_get_current_data_ex(XG(profile_filenames), (void **) &pfile, &pos) == SUCCESS) {
+		file = *pfile;
+		zend_hash_move_forward_ex(XG(profile_filenames), &pos);
+		if (!file->compile_count && !file->include_count) {
+			continue;
+		}
+		xdebug_file_printf(
+			XG(profile_file), "# file: compile=%lu execute=%lu autoload=%lu size=%ld compiles=%lu includes=%lu %s\n",
+			XDEBUG_NANOTIME_TO_MICROS(file->compile_time), XDEBUG_NANOTIME_TO_MICROS(file->execute_time),
+			XDEBUG_NANOTIME_TO_MICROS(file->autoload_time), file->size, file->compile_count, file->include_count, file->name
+		);
+	}
+}
+
+static void xdebug_profiler_write_categories(TSRMLS_D)
+{
+	xdebug_profiler_category *category;
+	int                       i;
+
+	for (i = 0; i < XG(profile_category_count); i++) {
+		category = &XG(profile_categories)[i];
+		if (category->calls) {
+			xdebug_file_printf(
+				XG(profile_file), "# category: time=%lu calls=%lu %s\n",
+				XDEBUG_NANOTIME_TO_MICROS(category->time), category->calls, category->name
+			);
+		}
+	}
+}
+
+/* Fills return_value with the time and number of calls per category */
+void xdebug_profiler_get_categories(zval *return_value TSRMLS_DC)
+{
+	xdebug_profiler_category *category;
+	zval                     *entry;
+	int                       i;
+
+	array_init(return_value);
+	for (i = 0; i < XG(profile_category_count); i++) {
+		category = &XG(profile_categories)[i];
+
+		MAKE_STD_ZVAL(entry);
+		array_init(entry);
+		add_assoc_double_ex(entry, "time", sizeof("time"), XDEBUG_NANOTIME_TO_SECONDS(category->time));
+		add_assoc_long_ex(entry, "calls", sizeof("calls"), category->calls);
+		add_assoc_zval_ex(return_value, category->name, strlen(category->name) + 1, entry);
+	}
+}
+
+static void xdebug_profiler_write_sql(TSRMLS_D)
+{
+	xdebug_profiler_sql **psql, *sql;
+	HashPosition          pos;
+
+	zend_hash_sort(XG(profile_sql), zend_qsort, xdebug_profiler_sql_cmp, 0 TSRMLS_CC);
+	zend_hash_internal_pointer_reset_ex(XG(profile_sql), &pos);
+	while (zend_hash_get_current_data_ex(XG(profile_sql), (void **) &psql, &pos) == SUCCESS) {
+		sql = *psql;
+		zend_hash_move_forward_ex(XG(profile_sql), &pos);
+
+		xdebug_file_printf(
+			XG(profile_file), "# sql: time=%lu max=%lu count=%lu %s\n",
+			XDEBUG_NANOTIME_TO_MICROS(sql->time), XDEBUG_NANOTIME_TO_MICROS(sql->max_time), sql->count, sql->sql
+		);
+	}
+}
+
+/* Fills return_value with the count, total and longest time per normalized
+ * statement, most expensive first */
+void xdebug_profiler_get_sql(zval *return_value TSRMLS_DC)
+{
+	xdebug_profiler_sql **psql, *sql;
+	HashPosition          pos;
+	zval                 *entry;
+
+	array_init(return_value);
+	zend_hash_sort(XG(profile_sql), zend_qsort, xdebug_profiler_sql_cmp, 0 TSRMLS_CC);
+	zend_hash_internal_pointer_reset_ex(XG(profile_sql), &pos);
+	while (zend_hash_get_current_data_ex(XG(profile_sql), (void **) &psql, &pos) == SUCCESS) {
+		sql = *psql;
+		zend_hash_move_forward_ex(XG(profile_sql), &pos);
+
+		MAKE_STD_ZVAL(entry);
+		array_init(entry);
+		add_assoc_long_ex(entry, "count", sizeof("count"), sql->count);
+		add_assoc_double_ex(entry, "time", sizeof("time"), XDEBUG_NANOTIME_TO_SECONDS(sql->time));
+		add_assoc_double_ex(entry, "max_time", sizeof("max_time"), XDEBUG_NANOTIME_TO_SECONDS(sql->max_time));
+		add_assoc_zval_ex(return_value, sql->sql, strlen(sql->sql) + 1, entry);
+	}
+}
+
+/* Logs every call site that ran the same statement at least
+ * xdebug.profiler_repeat_threshold times, and lists it in the profile */
+static void xdebug_profiler_report_repeats(TSRMLS_D)
+{
+	xdebug_profiler_repeat *repeat;
+	HashPosition            pos;
+	char                   *message;
+
+	zend_hash_internal_pointer_reset_ex(XG(profile_repeats), &pos);
+	while (zend_hash_get_current_data_ex(XG(profile_repeats), (void **) &repeat, &pos) == SUCCESS) {
+		zend_hash_move_forward_ex(XG(profile_repeats), &pos);
+		if (repeat->count < (unsigned long) XG(profiler_repeat_threshold)) {
+			continue;
+		}
+
+		message = xdebug_sprintf(
+			"Xdebug: the same query ran %lu times from %s:%ld in %s, taking %.6f seconds: %s",
+			repeat->count,
+			repeat->key.caller ? repeat->key.caller->file->name : "{unknown}",
+			repeat->key.lineno,
+			repeat->key.caller ? repeat->key.caller->name : "{unknown}",
+			XDEBUG_NANOTIME_TO_SECONDS(repeat->time),
+			repeat->key.sql->sql
+		);
+		php_log_err(message TSRMLS_CC);
+		xdfree(message);
+
+		if (XG(profile_file) && XG(profile_mode) != XDEBUG_PROFILER_MODE_FOLDED) {
+			xdebug_file_printf(
+				XG(profile_file), "# repeated query: time=%lu count=%lu %s:%ld %s\n",
+				XDEBUG_NANOTIME_TO_MICROS(repeat->time), repeat->count,
+				repeat->key.caller ? repeat->key.caller->file->name : "{unknown}", repeat->key.lineno,
+				repeat->key.sql->sql
+			);
+		}
+	}
+}
+
+/* Fills return_value with the call sites that ran the same statement at
+ * least xdebug.profiler_repeat_threshold times so far */
+void xdebug_profiler_get_repeats(zval *return_value TSRMLS_DC)
+{
+	xdebug_profiler_repeat *repeat;
+	HashPosition            pos;
+	zval                   *entry;
+
+	array_init(return_value);
+	zend_hash_internal_pointer_reset_ex(XG(profile_repeats), &pos);
+	while (zend_hash_get_current_data_ex(XG(profile_repeats), (void **) &repeat, &pos) == SUCCESS) {
+		zend_hash_move_forward_ex(XG(profile_repeats), &pos);
+		if (repeat->count < (unsigned long) XG(profiler_repeat_threshold)) {
+			continue;
+		}
+
+		MAKE_STD_ZVAL(entry);
+		array_init(entry);
+		add_assoc_string_ex(entry, "sql", sizeof("sql"), repeat->key.sql->sql, 1);
+		if (repeat->key.caller) {
+			add_assoc_string_ex(entry, "function", sizeof("function"), repeat->key.caller->name, 1);
+			add_assoc_string_ex(entry, "file", sizeof("file"), repeat->key.caller->file->name, 1);
+		}
+		add_assoc_long_ex(entry, "line", sizeof("line"), repeat->key.lineno);
+		add_assoc_long_ex(entry, "count", sizeof("count"), repeat->count);
+		add_assoc_double_ex(entry, "time", sizeof("time"), XDEBUG_NANOTIME_TO_SECONDS(repeat->time));
+		add_next_index_zval(return_value, entry);
+	}
+}
+
+/* Finds the child of a stack trie node for a function, or adds it */
+typedef struct _xdebug_profiler_stack_key {
+	long parent;
+	long func;
+} xdebug_profiler_stack_key;
+
+static long xdebug_profiler_stack_node_get(long parent, xdebug_profiler_function *func TSRMLS_DC)
+{
+	xdebug_profiler_stack_key   key;
+	xdebug_profiler_stack_node *node;
+	long                       *index, new_index;
+
+	key.parent = parent;
+	key.func = func->id;
+
+	if (zend_hash_find(XG(profile_stack_children), (char *) &key, sizeof(key), (void **) &index) == SUCCESS) {
+		return *index;
+	}
+
+	if (XG(profile_stack_node_count) == XG(profile_stack_node_size)) {
+		XG(profile_stack_node_size) = XG(profile_stack_node_size) ? XG(profile_stack_node_size) * 2 : 1024;
+		XG(profile_stack_nodes) = xdrealloc(XG(profile_stack_nodes), XG(profile_stack_node_size) * sizeof(xdebug_profiler_stack_node));
+	}
+	new_index = XG(profile_stack_node_count)++;
+	node = &XG(profile_stack_nodes)[new_index];
+	node->func = func;
+	node->parent = parent;
+	node->time = 0;
+	zend_hash_add(XG(profile_stack_children), (char *) &key, sizeof(key), (void *) &new_index, sizeof(long), NULL);
+
+	return new_index;
+}
+
+static void xdebug_profiler_add_stack(xdebug_str *str, long index TSRMLS_DC)
+{
+	xdebug_profiler_stack_node *node = &XG(profile_stack_nodes)[index];
+
+	if (node->parent != -1) {
+		xdebug_profiler_add_stack(str, node->parent TSRMLS_CC);
+		xdebug_str_addl(str, ";", 1, 0);
+	}
+	/* Flame graphs show PHP's functions by their own names */
+	xdebug_str_add(str, node->func->name + (node->func->is_internal ? sizeof("php::") - 1 : 0), 0);
+}
+
+/* Writes one "caller;...;function time" line per distinct stack, with the
+ * time in nanoseconds that was spent in the function itself with exactly
+ * that stack; flame graph tools add those up into inclusive time. Nothing is
+ * rounded, so even stacks that take less than a microsecond each time are
+ * all there, and the lines add up to the whole run. */
+static void xdebug_profiler_write_folded(TSRMLS_D)
+{
+	xdebug_str      stack = {0, 0, NULL};
+	xdebug_nanotime time;
+	long            i;
+
+	for (i = 0; i < XG(profile_stack_node_count); i++) {
+		time = XG(profile_stack_nodes)[i].time;
+		if (!time) {
+			continue;
+		}
+		stack.l = 0;
+		xdebug_profiler_add_stack(&stack, i TSRMLS_CC);
+		xdebug_file_printf(XG(profile_file), "%s %llu\n", stack.d, (unsigned long long) time);
+	}
+	xdebug_str_dtor(stack);
+}
+
+void xdebug_profiler_close_file(TSRMLS_D)
 {
-	xdebug_call_entry *ce = elem;
+	xdebug_file *file = XG(profile_file);
+	long         i;
 
-	if (ce->function) {
-		xdfree(ce->function);
+	if (XG(profiler_repeat_threshold) > 0) {
+		xdebug_profiler_report_repeats(TSRMLS_C);
 	}
-	if (ce->filename) {
-		xdfree(ce->filename);
+
+	if (file) {
+		if (XG(profile_mode) == XDEBUG_PROFILER_MODE_MERGED || XG(profile_mode) == XDEBUG_PROFILER_MODE_SAMPLE) {
+			xdebug_profiler_write_merged(TSRMLS_C);
+		} else if (XG(profile_mode) == XDEBUG_PROFILER_MODE_FOLDED) {
+			xdebug_profiler_write_folded(TSRMLS_C);
+		}
+		if (XG(profile_mode) != XDEBUG_PROFILER_MODE_FOLDED) {
+			xdebug_profiler_write_files(TSRMLS_C);
+			xdebug_profiler_write_categories(TSRMLS_C);
+			if (XG(profiler_sql)) {
+				xdebug_profiler_write_sql(TSRMLS_C);
+			}
+		}
+
+		/* The statistics line itself is not included in the counts */
+		xdebug_file_sync(file);
+		if (XG(profile_mode) == XDEBUG_PROFILER_MODE_FOLDED) {
+			/* no comments in folded output */
+		} else if (file->dropped_bytes) {
+			xdebug_file_printf(file, "# output: %lu bytes in %lu writes, %lu bytes dropped\n", file->bytes_written, file->flush_count, file->dropped_bytes);
+		} else {
+			xdebug_file_printf(file, "# output: %lu bytes in %lu writes\n", file->bytes_written, file->flush_count);
+		}
+		xdebug_file_close(file);
+		XG(profile_file) = NULL;
 	}
-	xdfree(ce);
-}
 
-int xdebug_profiler_init(char *script_name TSRMLS_DC)
-{
-	char *filename = NULL, *fname = NULL;
-	
-	if (!strlen(XG(profiler_output_name)) ||
-		xdebug_format_output_filename(&fname, XG(profiler_output_name), script_name) <= 0
-	) {
-		/* Invalid or empty xdebug.profiler_output_name */
-		return FAILURE;
+	for (i = 0; i < XG(profile_function_count); i++) {
+		if (XG(profile_functions)[i]->line_times) {
+			xdfree(XG(profile_functions)[i]->line_times);
+		}
+		xdfree(XG(profile_functions)[i]->name);
+		xdfree(XG(profile_functions)[i]);
 	}
-	filename = xdebug_sprintf("%s/%s", XG(profiler_output_dir), fname);
-	xdfree(fname);
-		
-	if (XG(profiler_append)) {
-		XG(profile_file) = xdebug_fopen(filename, "a", NULL, &XG(profile_filename));
-	} else {
-		XG(profile_file) = xdebug_fopen(filename, "w", NULL, &XG(profile_filename));
+	if (XG(profile_functions)) {
+		xdfree(XG(profile_functions));
 	}
-	xdfree(filename);
+	XG(profile_functions) = NULL;
+	XG(profile_function_count) = 0;
+	XG(profile_function_size) = 0;
 
-	if (!XG(profile_file)) {
-		return FAILURE;
+	while (XG(profile_call_blocks)) {
+		xdebug_profiler_call_block *block = XG(profile_call_blocks);
+
+		XG(profile_call_blocks) = block->next;
+		xdfree(block);
 	}
-	if (XG(profiler_append)) {
-		fprintf(XG(profile_file), "\n==== NEW PROFILING FILE ==============================================\n");
+	XG(profile_call_free) = NULL;
+
+	if (XG(profile_stack_nodes)) {
+		xdfree(XG(profile_stack_nodes));
 	}
-	fprintf(XG(profile_file), "version: 0.9.6\ncmd: %s\npart: 1\n\nevents: Time\n\n", script_name);
-	fflush(XG(profile_file));
-	return SUCCESS;
+	XG(profile_stack_nodes) = NULL;
+	XG(profile_stack_node_count) = 0;
+	XG(profile_stack_node_size) = 0;
+	zend_hash_destroy(XG(profile_stack_children));
+	xdfree(XG(profile_stack_children));
+	XG(profile_stack_children) = NULL;
+	zend_hash_destroy(XG(profile_repeats));
+	xdfree(XG(profile_repeats));
+	XG(profile_repeats) = NULL;
+	zend_hash_destroy(XG(profile_sql_cache));
+	xdfree(XG(profile_sql_cache));
+	XG(profile_sql_cache) = NULL;
+	zend_hash_destroy(XG(profile_sql));
+	xdfree(XG(profile_sql));
+	XG(profile_sql) = NULL;
+
+	xdebug_profiler_categories_free(TSRMLS_C);
+	xdebug_profiler_filter_free(XG(profile_include));
+	xdebug_profiler_filter_free(XG(profile_exclude));
+	xdebug_profiler_filter_free(XG(profile_query_functions));
+	xdebug_profiler_filter_free(XG(profile_lines));
+	XG(profile_lines) = NULL;
+	XG(profile_include) = NULL;
+	XG(profile_exclude) = NULL;
+	XG(profile_query_functions) = NULL;
+
+	zend_hash_destroy(XG(profile_filenames));
+	xdfree(XG(profile_filenames));
+	zend_hash_destroy(XG(profile_function_names));
+	xdfree(XG(profile_function_names));
+	zend_hash_destroy(XG(profile_function_cache));
+	xdfree(XG(profile_function_cache));
+	zend_hash_destroy(XG(profile_edges));
+	xdfree(XG(profile_edges));
+	XG(profile_filenames) = NULL;
+	XG(profile_function_names) = NULL;
+	XG(profile_function_cache) = NULL;
+	XG(profile_edges) = NULL;
 }
 
-void xdebug_profiler_deinit(TSRMLS_D)
+/* Comparison functions for xdebug_get_profile_summary(), largest first */
+#define XDEBUG_PROFILER_SUMMARY_CMP(name, field) \
+	static int xdebug_profiler_summary_cmp_##name(const void *a, const void *b) \
+	{ \
+		xdebug_profiler_function *fa = *(xdebug_profiler_function **) a; \
+		xdebug_profiler_function *fb = *(xdebug_profiler_function **) b; \
+		\
+		if (fa->field != fb->field) { \
+			return fa->field > fb->field ? -1 : 1; \
+		} \
+		return fa->id < fb->id ? -1 : 1; \
+	}
+
+XDEBUG_PROFILER_SUMMARY_CMP(time, cost_inclusive.time)
+XDEBUG_PROFILER_SUMMARY_CMP(time_own, cost_own.time)
+XDEBUG_PROFILER_SUMMARY_CMP(memory, cost_inclusive.memory)
+XDEBUG_PROFILER_SUMMARY_CMP(memory_own, cost_own.memory)
+XDEBUG_PROFILER_SUMMARY_CMP(calls, call_count)
+
+/* Fills return_value with one array per function that has returned at least
+ * once, sorted on the given key and cut off after limit entries (if > 0).
+ * Functions that are still running are not in the totals yet. */
+void xdebug_profiler_get_summary(zval *return_value, long limit, int sort TSRMLS_DC)
 {
-	function_stack_entry *fse;
-	xdebug_llist_element *le;
+	xdebug_profiler_function **funcs;
+	xdebug_profiler_function  *func;
+	zval                      *entry;
+	long                       i, count = 0;
+	int (*cmp)(const void *, const void *);
 
-	for (le = XDEBUG_LLIST_TAIL(XG(stack)); le != NULL; le = XDEBUG_LLIST_PREV(le)) {
-		fse = XDEBUG_LLIST_VALP(le);
-		if (fse->user_defined == XDEBUG_INTERNAL) {
-			xdebug_profiler_function_internal_end(fse TSRMLS_CC);
-		} else {
-			xdebug_profiler_function_user_end(fse, fse->op_array TSRMLS_CC);
+	array_init(return_value);
+	if (!XG(profile_function_count)) {
+		return;
+	}
+
+	funcs = xdmalloc(XG(profile_function_count) * sizeof(xdebug_profiler_function *));
+	for (i = 0; i < XG(profile_function_count); i++) {
+		if (XG(profile_functions)[i]->call_count) {
+			funcs[count++] = XG(profile_functions)[i];
+		}
+	}
+
+	switch (sort) {
+		case XDEBUG_PROFILER_SORT_TIME_OWN:   cmp = xdebug_profiler_summary_cmp_time_own; break;
+		case XDEBUG_PROFILER_SORT_MEMORY:     cmp = xdebug_profiler_summary_cmp_memory; break;
+		case XDEBUG_PROFILER_SORT_MEMORY_OWN: cmp = xdebug_profiler_summary_cmp_memory_own; break;
+		case XDEBUG_PROFILER_SORT_CALLS:      cmp = xdebug_profiler_summary_cmp_calls; break;
+		default:                              cmp = xdebug_profiler_summary_cmp_time; break;
+	}
+	qsort(funcs, count, sizeof(xdebug_profiler_function *), cmp);
+
+	if (limit > 0 && limit < count) {
+		count = limit;
+	}
+	for (i = 0; i < count; i++) {
+		func = funcs[i];
+
+		MAKE_STD_ZVAL(entry);
+		array_init(entry);
+		add_assoc_string_ex(entry, "function", sizeof("function"), func->name, 1);
+		add_assoc_string_ex(entry, "file", sizeof("file"), func->file->name, 1);
+		add_assoc_long_ex(entry, "line", sizeof("line"), func->lineno);
+		add_assoc_long_ex(entry, "calls", sizeof("calls"), func->call_count);
+		add_assoc_double_ex(entry, "time", sizeof("time"), XDEBUG_NANOTIME_TO_SECONDS(func->cost_inclusive.time));
+		add_assoc_double_ex(entry, "time_own", sizeof("time_own"), XDEBUG_NANOTIME_TO_SECONDS(func->cost_own.time));
+		add_assoc_long_ex(entry, "memory", sizeof("memory"), func->cost_inclusive.memory);
+		add_assoc_long_ex(entry, "memory_own", sizeof("memory_own"), func->cost_own.memory);
+		if (XG(profiler_cpu_time)) {
+			add_assoc_double_ex(entry, "cpu", sizeof("cpu"), XDEBUG_NANOTIME_TO_SECONDS(func->cost_inclusive.cpu));
+			add_assoc_double_ex(entry, "cpu_own", sizeof("cpu_own"), XDEBUG_NANOTIME_TO_SECONDS(func->cost_own.cpu));
 		}
+		add_next_index_zval(return_value, entry);
 	}
+
+	xdfree(funcs);
 }
 
-static inline void xdebug_profiler_function_push(function_stack_entry *fse)
+static inline void xdebug_profiler_function_push(function_stack_entry *fse, xdebug_nanotime now)
 {
-	fse->profile.time += xdebug_get_utime();
+	fse->profile.time += now;
 	fse->profile.time -= fse->profile.mark;
 	fse->profile.mark = 0;
 }
 
 void xdebug_profiler_function_continue(function_stack_entry *fse)
 {
-	fse->profile.mark = xdebug_get_utime();
+	fse->profile.mark = xdebug_get_nanotime();
 }
 
 void xdebug_profiler_function_pause(function_stack_entry *fse)
 {
-	xdebug_profiler_function_push(fse);
+	xdebug_profiler_function_push(fse, xdebug_get_nanotime());
 }
 
-void xdebug_profiler_function_user_begin(function_stack_entry *fse TSRMLS_DC)
+static void xdebug_profiler_function_begin(function_stack_entry *fse, zend_function *zfunc TSRMLS_DC)
 {
+	function_stack_entry *prev = fse->prev;
+
+	fse->profile.func = xdebug_profiler_get_function(fse, zfunc TSRMLS_CC);
+
+	/* Calls made from excluded functions are attributed to the nearest
+	 * included caller, as if they were made from the line where that called
+	 * into the excluded code */
+	if (!prev || !prev->profile.func || prev->profile.func->included) {
+		fse->profile.parent = prev;
+		fse->profile.call_lineno = fse->lineno;
+	} else {
+		fse->profile.parent = prev->profile.parent;
+		fse->profile.call_lineno = prev->profile.call_lineno;
+	}
+
+	/* Excluded functions are not measured at all; their cost simply stays
+	 * part of their parent's own cost */
+	if (!fse->profile.func->included) {
+		return;
+	}
+
+	if (fse->profile.func->category != -1) {
+		XG(profile_category_depth)++;
+	}
+
+	/* The first file compiled while an autoloader runs is the one it loaded;
+	 * outer autoloads get their own file back when this one ends */
+	if (fse->profile.func->is_autoload) {
+		fse->profile.autoload_saved = XG(profile_autoload_file);
+		XG(profile_autoload_file) = NULL;
+		XG(profile_autoload_depth)++;
+	}
+
+	if (XG(profile_mode) == XDEBUG_PROFILER_MODE_FOLDED) {
+		fse->profile.stack_node = xdebug_profiler_stack_node_get(
+			fse->profile.parent ? fse->profile.parent->profile.stack_node : -1,
+			fse->profile.func TSRMLS_CC
+		);
+	}
+
+	memset(&fse->profile.cost, 0, sizeof(xdebug_profiler_cost));
+	memset(&fse->profile.children, 0, sizeof(xdebug_profiler_cost));
+#if HAVE_PHP_MEMORY_USAGE
+	fse->profile.memory_mark = XG_MEMORY_USAGE();
+	fse->profile.peak_memory_mark = XG_MEMORY_PEAK_USAGE();
+#endif
+	if (XG(profiler_cpu_time)) {
+		fse->profile.cpu_mark = xdebug_get_thread_cputime();
+	}
 	fse->profile.time = 0;
-	fse->profile.mark = xdebug_get_utime();
+	fse->profile.mark = xdebug_get_nanotime();
+
+	if (fse->profile.func->line_count && XG(profile_mode) != XDEBUG_PROFILER_MODE_FOLDED) {
+		fse->profile.line_times = xdcalloc(fse->profile.func->line_count, sizeof(xdebug_nanotime));
+		fse->profile.line = fse->profile.func->lineno;
+		fse->profile.line_mark = fse->profile.mark;
+		fse->profile.line_children = 0;
+	}
+}
+
+/* Adds the own time since the last statement to the line that was running */
+static void xdebug_profiler_line_push(function_stack_entry *fse, xdebug_nanotime now)
+{
+	int index = fse->profile.line - fse->profile.func->lineno;
+
+	if (index >= 0 && index < fse->profile.func->line_count) {
+		fse->profile.line_times[index] += (now - fse->profile.line_mark) - (fse->profile.children.time - fse->profile.line_children);
+	}
+	fse->profile.line_mark = now;
+	fse->profile.line_children = fse->profile.children.time;
 }
 
+/* Called for every statement while xdebug.profiler_lines is set; only the
+ * functions it matches keep line costs */
+void xdebug_profiler_statement(zend_op_array *op_array, int lineno TSRMLS_DC)
+{
+	function_stack_entry *fse;
 
-void xdebug_profiler_function_user_end(function_stack_entry *fse, zend_op_array* op_array TSRMLS_DC)
+	if (!XG(stack) || !XDEBUG_LLIST_TAIL(XG(stack))) {
+		return;
+	}
+	fse = XDEBUG_LLIST_VALP(XDEBUG_LLIST_TAIL(XG(stack)));
+	if (!fse->profile.line_times || fse->op_array != op_array) {
+		return;
+	}
+
+	xdebug_profiler_line_push(fse, xdebug_get_nanotime());
+	fse->profile.line = lineno;
+}
+
+void xdebug_profiler_function_user_begin(function_stack_entry *fse TSRMLS_DC)
+{
+	xdebug_profiler_function_begin(fse, (zend_function *) fse->op_array TSRMLS_CC);
+}
+
+typedef struct _xdebug_profiler_edge_key {
+	long caller;
+	long callee;
+	long lineno;
+} xdebug_profiler_edge_key;
+
+static void xdebug_profiler_add_edge(xdebug_profiler_function *caller, xdebug_profiler_function *callee, int lineno, unsigned long count, xdebug_profiler_cost *cost TSRMLS_DC)
+{
+	xdebug_profiler_edge_key  key;
+	xdebug_profiler_edge     *edge, new_edge;
+
+	key.caller = caller->id;
+	key.callee = callee->id;
+	key.lineno = lineno;
+
+	if (zend_hash_find(XG(profile_edges), (char *) &key, sizeof(key), (void **) &edge) == FAILURE) {
+		new_edge.callee = callee;
+		new_edge.lineno = lineno;
+		new_edge.call_count = 0;
+		memset(&new_edge.cost_inclusive, 0, sizeof(xdebug_profiler_cost));
+		new_edge.next = NULL;
+		zend_hash_add(XG(profile_edges), (char *) &key, sizeof(key), (void *) &new_edge, sizeof(xdebug_profiler_edge), (void **) &edge);
+
+		/* Keep the caller's edges in the order they were first seen */
+		if (caller->edges_tail) {
+			caller->edges_tail->next = edge;
+		} else {
+			caller->edges = edge;
+		}
+		caller->edges_tail = edge;
+	}
+	edge->call_count += count;
+	XDEBUG_PROFILER_COST_ADD(edge->cost_inclusive, *cost);
+}
+
+/* Switches the rest of the request over to merged mode. Calls that already
+ * ended, but whose callers are still running, are turned into edges. The
+ * records that were already written stay; tools add up the records of a
+ * function. */
+static void xdebug_profiler_downgrade(TSRMLS_D)
 {
 	xdebug_llist_element *le;
-	char                 *tmp_fname, *tmp_name;
-	int                   default_lineno = 0;
+	function_stack_entry *fse;
+	xdebug_call_entry    *ce;
+
+	for (le = XDEBUG_LLIST_HEAD(XG(stack)); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+		fse = XDEBUG_LLIST_VALP(le);
+		if (!fse->profile.func) {
+			continue;
+		}
+		for (ce = fse->profile.call_list; ce != NULL; ce = ce->next) {
+			xdebug_profiler_add_edge(fse->profile.func, ce->func, ce->lineno, 1, &ce->cost TSRMLS_CC);
+		}
+		xdebug_profiler_call_list_release(fse TSRMLS_CC);
+	}
+	XG(profile_mode) = XDEBUG_PROFILER_MODE_MERGED;
+}
+
+/* Runs after every record, but costs no more than a few compares for most
+ * of them. The byte count is exact. For the overhead, one record in
+ * XDEBUG_PROFILER_OVERHEAD_INTERVAL is timed, from the clock reading that
+ * ended its function to the end of its writing, and the average over all
+ * records timed so far stands in for every record written. */
+static void xdebug_profiler_check_budget(xdebug_nanotime checkpoint TSRMLS_DC)
+{
+	xdebug_nanotime now, elapsed;
+
+	if (XG(profiler_max_output) > 0 && XG(profile_file)->bytes_submitted > (unsigned long) XG(profiler_max_output)) {
+		xdebug_file_printf(XG(profile_file), "# xdebug.profiler_max_output of %ld bytes reached, merging the rest of the profile per function\n\n", XG(profiler_max_output));
+		xdebug_profiler_downgrade(TSRMLS_C);
+		return;
+	}
+	XG(profile_records)++;
+	if (XG(profiler_max_overhead) <= 0 || --XG(profile_budget_countdown) > 0) {
+		return;
+	}
+	XG(profile_budget_countdown) = XDEBUG_PROFILER_OVERHEAD_INTERVAL;
+
+	now = xdebug_get_nanotime();
+	XG(profile_overhead) += now - checkpoint;
+	XG(profile_overhead_samples)++;
+	elapsed = now - XG(profile_start_time);
+	if (
+		elapsed >= XDEBUG_PROFILER_OVERHEAD_WARMUP &&
+		XG(profile_overhead) * XG(profile_records) / XG(profile_overhead_samples) * 100 > (xdebug_nanotime) XG(profiler_max_overhead) * elapsed
+	) {
+		xdebug_file_printf(XG(profile_file), "# xdebug.profiler_max_overhead of %ld%% reached, merging the rest of the profile per function\n\n", XG(profiler_max_overhead));
+		xdebug_profiler_downgrade(TSRMLS_C);
+	}
+}
+
+void xdebug_profiler_function_user_end(function_stack_entry *fse, zend_op_array* op_array TSRMLS_DC)
+{
+	xdebug_profiler_function *func = fse->profile.func;
+	xdebug_call_entry        *call_entry;
+	xdebug_profiler_cost      cost_own;
+	int                       default_lineno = 0;
+	xdebug_nanotime           now;
+
+	if (!func->included) {
+		return;
+	}
+
+	now = xdebug_get_nanotime();
+	if (fse->profile.line_times) {
+		xdebug_profiler_line_push(fse, now);
+	}
+	xdebug_profiler_function_push(fse, now);
+	fse->profile.cost.time = fse->profile.time;
+#if HAVE_PHP_MEMORY_USAGE
+	fse->profile.cost.memory = XG_MEMORY_USAGE() - fse->profile.memory_mark;
+	fse->profile.cost.peak_memory = XG_MEMORY_PEAK_USAGE() - fse->profile.peak_memory_mark;
+#endif
+	if (XG(profiler_cpu_time)) {
+		fse->profile.cost.cpu = xdebug_get_thread_cputime() - fse->profile.cpu_mark;
+	}
+
+	cost_own = fse->profile.cost;
+	XDEBUG_PROFILER_COST_SUB(cost_own, fse->profile.children);
+
+	if (fse->profile.parent) {
+		XDEBUG_PROFILER_COST_ADD(fse->profile.parent->profile.children, fse->profile.cost);
+	}
+
+	if (func->category != -1 && --XG(profile_category_depth) == 0) {
+		XG(profile_categories)[func->category].time += fse->profile.cost.time;
+		XG(profile_categories)[func->category].calls++;
+	}
+	if (func->is_file) {
+		func->file->execute_time += fse->profile.cost.time;
+		func->file->include_count++;
+	}
+	if (func->is_autoload) {
+		if (XG(profile_autoload_file)) {
+			XG(profile_autoload_file)->autoload_time += fse->profile.cost.time;
+		}
+		XG(profile_autoload_file) = fse->profile.autoload_saved;
+		XG(profile_autoload_depth)--;
+	}
+
+	/* update aggregate data */
+	if (XG(profiler_aggregate)) {
+		if (fse->aggr_slot) {
+			xdebug_aggr_shm_cost shm_own, shm_inclusive;
+
+			shm_own.time = cost_own.time;
+			shm_own.memory = cost_own.memory;
+			shm_own.peak_memory = cost_own.peak_memory;
+			shm_inclusive.time = fse->profile.cost.time;
+			shm_inclusive.memory = fse->profile.cost.memory;
+			shm_inclusive.peak_memory = fse->profile.cost.peak_memory;
+			xdebug_aggr_shm_add(xdebug_aggr_shared, fse->aggr_slot, &shm_own, &shm_inclusive);
+			xdebug_aggr_shm_add_call(xdebug_aggr_shared, fse->aggr_edge_slot, &shm_inclusive);
+		} else if (fse->aggr_entry) {
+			XDEBUG_PROFILER_COST_ADD(fse->aggr_entry->cost_inclusive, fse->profile.cost);
+			XDEBUG_PROFILER_COST_ADD(fse->aggr_entry->cost_own, cost_own);
+			fse->aggr_entry->call_count++;
+		}
+	}
+
+	if (XG(profile_mode) == XDEBUG_PROFILER_MODE_FOLDED) {
+		XG(profile_stack_nodes)[fse->profile.stack_node].time += cost_own.time;
+		return;
+	}
+
+	if (XG(profile_mode) == XDEBUG_PROFILER_MODE_MERGED || XG(profile_mode) == XDEBUG_PROFILER_MODE_MEMORY) {
+		func->call_count++;
+		XDEBUG_PROFILER_COST_ADD(func->cost_inclusive, fse->profile.cost);
+		XDEBUG_PROFILER_COST_ADD(func->cost_own, cost_own);
+		/* The summary has no use for the call graph */
+		if (fse->profile.parent && XG(profile_mode) == XDEBUG_PROFILER_MODE_MERGED) {
+			xdebug_profiler_add_edge(fse->profile.parent->profile.func, func, fse->profile.call_lineno, 1, &fse->profile.cost TSRMLS_CC);
+		}
+		if (fse->profile.line_times && XG(profile_mode) == XDEBUG_PROFILER_MODE_MERGED) {
+			int i;
+
+			if (!func->line_times) {
+				func->line_times = xdcalloc(func->line_count, sizeof(xdebug_nanotime));
+			}
+			for (i = 0; i < func->line_count; i++) {
+				func->line_times[i] += fse->profile.line_times[i];
+			}
+		}
+		return;
+	}
 
-	xdebug_profiler_function_push(fse);
-	tmp_name = xdebug_show_fname(fse->function, 0, 0 TSRMLS_CC);
 	switch (fse->function.type) {
 		case XFUNC_INCLUDE:
 		case XFUNC_INCLUDE_ONCE:
 		case XFUNC_REQUIRE:
 		case XFUNC_REQUIRE_ONCE:
-			tmp_fname = xdebug_sprintf("%s::%s", tmp_name, fse->include_filename);
-			xdfree(tmp_name);
-			tmp_name = tmp_fname;
 			default_lineno = 1;
 			break;
 
@@ -150,115 +1657,371 @@ void xdebug_profiler_function_user_end(function_stack_entry *fse, zend_op_array*
 			break;
 	}
 
-	if (fse->prev) {
-		xdebug_call_entry *ce = xdmalloc(sizeof(xdebug_call_entry));
-		ce->filename = xdstrdup(fse->filename);
-		ce->function = xdstrdup(tmp_name);
-		ce->time_taken = fse->profile.time;
-		ce->lineno = fse->lineno;
-		ce->user_defined = fse->user_defined;
+	if (fse->profile.parent) {
+		function_stack_entry *parent = fse->profile.parent;
+		xdebug_call_entry    *ce = xdebug_profiler_call_entry_alloc(TSRMLS_C);
 
-		xdebug_llist_insert_next(fse->prev->profile.call_list, NULL, ce);
+		ce->type = 0;
+		ce->func = func;
+		ce->cost = fse->profile.cost;
+		ce->lineno = fse->profile.call_lineno;
+		ce->next = NULL;
+
+		if (parent->profile.call_list_tail) {
+			parent->profile.call_list_tail->next = ce;
+		} else {
+			parent->profile.call_list = ce;
+		}
+		parent->profile.call_list_tail = ce;
 	}
 
-	if (op_array) {
-		fprintf(XG(profile_file), "fl=%s\n", op_array->filename);
-	} else {
-		fprintf(XG(profile_file), "fl=php:internal\n");
+	xdebug_profiler_write_file_ref("fl", func->file TSRMLS_CC);
+	xdebug_profiler_write_function_ref("fn", func TSRMLS_CC);
+
+	if (func->is_main) {
+		xdebug_profiler_write_cost_summary(XG(profile_file), &fse->profile.cost TSRMLS_CC);
 	}
-	if (fse->user_defined == XDEBUG_EXTERNAL) {
-		fprintf(XG(profile_file), "fn=%s\n", tmp_name);
-	} else {
-		fprintf(XG(profile_file), "fn=php::%s\n", tmp_name);
+	xdebug_profiler_write_own_cost(default_lineno, &cost_own, func, fse->profile.line_times TSRMLS_CC);
+
+	/* dump call list */
+	for (call_entry = fse->profile.call_list; call_entry != NULL; call_entry = call_entry->next) {
+		xdebug_profiler_write_function_ref("cfn", call_entry->func TSRMLS_CC);
+		xdebug_file_printf(XG(profile_file), "calls=1 0 0\n");
+		xdebug_profiler_write_cost_line(XG(profile_file), call_entry->lineno, &call_entry->cost TSRMLS_CC);
 	}
-	xdfree(tmp_name);
+	xdebug_file_printf(XG(profile_file), "\n");
 
-	if (fse->function.function && strcmp(fse->function.function, "{main}") == 0) {
-		fprintf(XG(profile_file), "\nsummary: %lu\n\n", (unsigned long) (fse->profile.time * 1000000));
+	xdebug_profiler_call_list_release(fse TSRMLS_CC);
+
+	if (XG(profile_budget)) {
+		xdebug_profiler_check_budget(now TSRMLS_CC);
 	}
-	fflush(XG(profile_file));
+}
 
-	/* update aggregate data */
-	if (XG(profiler_aggregate)) {
-		fse->aggr_entry->time_inclusive += fse->profile.time;
-		fse->aggr_entry->call_count++;
+
+/* Whether the profiler needs to see an internal function: the autoloader,
+ * for the per file costs, functions that have a category or run SQL, and
+ * whatever xdebug.profiler_include explicitly asks for */
+int xdebug_profiler_includes_internal(zend_function *zf TSRMLS_DC)
+{
+	char *name;
+	int   included;
+
+	if (!zf->common.scope && strcmp(zf->common.function_name, "spl_autoload_call") == 0) {
+		return 1;
+	}
+	if (!XG(profile_include) && !XG(profile_category_count) && !XDEBUG_PROFILER_SQL_ENABLED()) {
+		return 0;
 	}
 
-	/* Subtract time in calledfunction from time here */
-	for (le = XDEBUG_LLIST_HEAD(fse->profile.call_list); le != NULL; le = XDEBUG_LLIST_NEXT(le))
-	{
-		xdebug_call_entry *call_entry = XDEBUG_LLIST_VALP(le);
-		fse->profile.time -= call_entry->time_taken;
+	if (zf->common.scope) {
+		name = xdebug_sprintf("%s::%s", zf->common.scope->name, zf->common.function_name);
+	} else {
+		name = xdstrdup(zf->common.function_name);
 	}
-	fprintf(XG(profile_file), "%d %lu\n", default_lineno, (unsigned long) (fse->profile.time * 1000000));
+	included =
+		(XG(profile_include) && xdebug_profiler_filter_match(XG(profile_include), name, "php:internal")) ||
+		xdebug_profiler_category_of(name TSRMLS_CC) != -1 ||
+		xdebug_profiler_sql_source(name TSRMLS_CC) != XDEBUG_PROFILER_SQL_NONE;
+	xdfree(name);
 
-	/* update aggregate data */
-	if (XG(profiler_aggregate)) {
-		fse->aggr_entry->time_own += fse->profile.time;
+	return included;
+}
+
+/* Called after every file compiled while the profiler runs */
+void xdebug_profiler_compiled(zend_op_array *op_array, xdebug_nanotime time TSRMLS_DC)
+{
+	xdebug_profiler_file *file;
+	struct stat           buf;
+
+	if (!op_array || !op_array->filename) {
+		return;
 	}
 
-	/* dump call list */
-	for (le = XDEBUG_LLIST_HEAD(fse->profile.call_list); le != NULL; le = XDEBUG_LLIST_NEXT(le))
-	{
-		xdebug_call_entry *call_entry = XDEBUG_LLIST_VALP(le);
+	file = xdebug_profiler_get_file(op_array->filename TSRMLS_CC);
+	file->compile_time += time;
+	file->compile_count++;
+	if (file->size == -1 && VCWD_STAT(op_array->filename, &buf) == 0) {
+		file->size = buf.st_size;
+	}
 
-		if (call_entry->user_defined == XDEBUG_EXTERNAL) {
-			fprintf(XG(profile_file), "cfn=%s\n", call_entry->function);
-		} else {
-			fprintf(XG(profile_file), "cfn=php::%s\n", call_entry->function);
+	if (XG(profile_autoload_depth) && !XG(profile_autoload_file)) {
+		XG(profile_autoload_file) = file;
+	}
+}
+
+/* Fills return_value with the costs of loading each file, keyed by file
+ * name */
+void xdebug_profiler_get_files(zval *return_value TSRMLS_DC)
+{
+	xdebug_profiler_file **pfile, *file;
+	zval                  *entry;
+	HashPosition           pos;
+
+	array_init(return_value);
+
+	zend_hash_internal_pointer_reset_ex(XG(profile_filenames), &pos);
+	while (zend_hash_get_current_data_ex(XG(profile_filenames), (void **) &pfile, &pos) == SUCCESS) {
+		file = *pfile;
+		zend_hash_move_forward_ex(XG(profile_filenames), &pos);
+		if (!file->compile_count && !file->include_count) {
+			continue;
 		}
-		
-		fprintf(XG(profile_file), "calls=1 0 0\n");
-		fprintf(XG(profile_file), "%d %lu\n", call_entry->lineno, (unsigned long) (call_entry->time_taken * 1000000));
+
+		MAKE_STD_ZVAL(entry);
+		array_init(entry);
+		add_assoc_double_ex(entry, "compile_time", sizeof("compile_time"), XDEBUG_NANOTIME_TO_SECONDS(file->compile_time));
+		add_assoc_double_ex(entry, "execute_time", sizeof("execute_time"), XDEBUG_NANOTIME_TO_SECONDS(file->execute_time));
+		add_assoc_double_ex(entry, "autoload_time", sizeof("autoload_time"), XDEBUG_NANOTIME_TO_SECONDS(file->autoload_time));
+		add_assoc_long_ex(entry, "size", sizeof("size"), file->size);
+		add_assoc_long_ex(entry, "compiles", sizeof("compiles"), file->compile_count);
+		add_assoc_long_ex(entry, "includes", sizeof("includes"), file->include_count);
+		add_assoc_zval_ex(return_value, file->name, strlen(file->name) + 1, entry);
 	}
-	fprintf(XG(profile_file), "\n");
-	fflush(XG(profile_file));
 }
 
+/* The statement a call runs: its first string argument, so that
+ * mysqli_query($link, $sql) works too, or the queryString of the PDO
+ * statement it is called on */
+static zval *xdebug_profiler_sql_statement(int source TSRMLS_DC)
+{
+	zend_execute_data *edata = EG(current_execute_data);
+
+	if (source == XDEBUG_PROFILER_SQL_ARGUMENT) {
+		zval *arg;
+		int   i;
+#if PHP_VERSION_ID >= 50300
+		void **args = edata->function_state.arguments;
+		int    argc = args ? (int)(zend_uintptr_t) *args : 0;
+
+		for (i = 0; i < argc; i++) {
+			arg = *(zval **) (args - argc + i);
+			if (arg && Z_TYPE_P(arg) == IS_STRING) {
+				return arg;
+			}
+		}
+#else
+		zval **param;
+
+		for (i = 1; zend_ptr_stack_get_arg(i, (void **) &param TSRMLS_CC) == SUCCESS; i++) {
+			arg = param ? *param : NULL;
+			if (arg && Z_TYPE_P(arg) == IS_STRING) {
+				return arg;
+			}
+		}
+#endif
+		return NULL;
+	}
+	if (edata->object && Z_TYPE_P(edata->object) == IS_OBJECT) {
+		return zend_read_property(Z_OBJCE_P(edata->object), edata->object, "queryString", sizeof("queryString") - 1, 1 TSRMLS_CC);
+	}
+	return NULL;
+}
 
 void xdebug_profiler_function_internal_begin(function_stack_entry *fse TSRMLS_DC)
 {
-	xdebug_profiler_function_user_begin(fse TSRMLS_CC);
+	xdebug_profiler_function_begin(fse, EG(current_execute_data)->function_state.function TSRMLS_CC);
+
+	fse->profile.sql = NULL;
+	if (fse->profile.func->sql && fse->profile.func->included) {
+		fse->profile.sql = xdebug_profiler_sql_statement(fse->profile.func->sql TSRMLS_CC);
+	}
 }
 
 
 void xdebug_profiler_function_internal_end(function_stack_entry *fse TSRMLS_DC)
 {
 	xdebug_profiler_function_user_end(fse, NULL TSRMLS_CC);
+
+	/* Normalizing is left until the call has been measured */
+	if (fse->profile.sql) {
+		xdebug_profiler_sql *sql = xdebug_profiler_sql_add(fse->profile.sql, fse->profile.cost.time TSRMLS_CC);
+
+		if (sql && XG(profiler_repeat_threshold) > 0) {
+			xdebug_profiler_repeat_add(sql, fse TSRMLS_CC);
+		}
+		fse->profile.sql = NULL;
+	}
+}
+
+#ifdef XDEBUG_PROFILER_SAMPLING
+static pthread_t xdebug_profiler_sample_thread;
+
+/* The one timer thread for the request. It sleeps until each sample is due
+ * and counts it, plus any it overslept; as no signal is delivered to the PHP
+ * thread itself, system calls made by the script are never interrupted. The
+ * thread is cancelled while it sleeps. */
+static void *xdebug_profiler_sample_main(void *arg)
+{
+	volatile long  *pending = (volatile long *) arg;
+	xdebug_nanotime interval = (xdebug_nanotime) XG(profile_sample_interval) * NANOS_IN_MICRO;
+	xdebug_nanotime due, now;
+	struct timespec ts;
+	long            samples;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	due = (xdebug_nanotime) ts.tv_sec * NANOS_IN_SEC + ts.tv_nsec;
+	while (1) {
+		due += interval;
+		ts.tv_sec = due / NANOS_IN_SEC;
+		ts.tv_nsec = due % NANOS_IN_SEC;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = (xdebug_nanotime) ts.tv_sec * NANOS_IN_SEC + ts.tv_nsec;
+		samples = 1 + (now - due) / interval;
+		due += (samples - 1) * interval;
+		__sync_fetch_and_add(pending, samples);
+	}
+
+	return NULL;
+}
+#endif
+
+int xdebug_profiler_sample_start(TSRMLS_D)
+{
+#ifdef XDEBUG_PROFILER_SAMPLING
+	long interval = XG(profiler_sample_interval);
+
+	if (interval < 1000) {
+		interval = 1000;
+	}
+
+	XG(profile_sample_interval) = interval;
+	XG(profile_samples_pending) = 0;
+	if (pthread_create(&xdebug_profiler_sample_thread, NULL, xdebug_profiler_sample_main, (void *) &XG(profile_samples_pending)) != 0) {
+		return FAILURE;
+	}
+	xdebug_file_printf(XG(profile_file), "# sampled every %ld us, calls= are sample counts\n\n", interval);
+
+	return SUCCESS;
+#else
+	return FAILURE;
+#endif
+}
+
+void xdebug_profiler_sample_stop(TSRMLS_D)
+{
+#ifdef XDEBUG_PROFILER_SAMPLING
+	pthread_cancel(xdebug_profiler_sample_thread);
+	pthread_join(xdebug_profiler_sample_thread, NULL);
+#endif
+	XDEBUG_PROFILER_SAMPLE_CHECK();
+	XG(profiler_sampling) = 0;
+}
+
+/* Attributes the samples that became due since the last check to the
+ * functions that are on the stack right now */
+void xdebug_profiler_sample(TSRMLS_D)
+{
+	xdebug_llist_element     *le;
+	function_stack_entry     *fse;
+	xdebug_profiler_function *func, *caller = NULL;
+	long                      samples;
+	xdebug_profiler_cost      cost;
+	int                       lineno = -1;
+
+	/* The timer thread may add to the count at any time */
+	samples = __sync_lock_test_and_set(&XG(profile_samples_pending), 0);
+	if (!XG(profiler_sampling)) {
+		return;
+	}
+	/* Memory usage is not sampled */
+	memset(&cost, 0, sizeof(xdebug_profiler_cost));
+	cost.time = (xdebug_nanotime) samples * XG(profile_sample_interval) * NANOS_IN_MICRO;
+
+	for (le = XDEBUG_LLIST_HEAD(XG(stack)); le != NULL; le = XDEBUG_LLIST_NEXT(le)) {
+		fse = XDEBUG_LLIST_VALP(le);
+		if (!fse->profile.func) {
+			fse->profile.func = xdebug_profiler_get_function(fse, fse->user_defined == XDEBUG_EXTERNAL ? (zend_function *) fse->op_array : NULL TSRMLS_CC);
+		}
+		func = fse->profile.func;
+
+		/* Excluded frames are skipped, like in the other modes */
+		if (lineno == -1) {
+			lineno = fse->lineno;
+		}
+		if (!func->included) {
+			continue;
+		}
+
+		func->call_count += samples;
+		XDEBUG_PROFILER_COST_ADD(func->cost_inclusive, cost);
+		if (caller) {
+			xdebug_profiler_add_edge(caller, func, lineno, samples, &cost TSRMLS_CC);
+		}
+		caller = func;
+		lineno = -1;
+	}
+	if (caller) {
+		XDEBUG_PROFILER_COST_ADD(caller->cost_own, cost);
+	}
 }
 
 static int xdebug_print_aggr_entry(void *pDest, void *argument TSRMLS_DC)
 {
-	FILE *fp = (FILE *) argument;
+	xdebug_file *fp = (xdebug_file *) argument;
 	xdebug_aggregate_entry *xae = (xdebug_aggregate_entry *) pDest;
 
-	fprintf(fp, "fl=%s\n", xae->filename);
-	fprintf(fp, "fn=%s\n", xae->function);
-	fprintf(fp, "%d %lu\n", 0, (unsigned long) (xae->time_own * 1000000));
+	xdebug_file_printf(fp, "fl=%s\n", xae->filename);
+	xdebug_file_printf(fp, "fn=%s\n", xae->function);
+	xdebug_profiler_write_cost_line(fp, 0, &xae->cost_own TSRMLS_CC);
 	if (strcmp(xae->function, "{main}") == 0) {
-		fprintf(fp, "\nsummary: %lu\n\n", (unsigned long) (xae->time_inclusive * 1000000));
+		xdebug_profiler_write_cost_summary(fp, &xae->cost_inclusive TSRMLS_CC);
 	}
 	if (xae->call_list) {
 		xdebug_aggregate_entry **xae_call;
 
 		zend_hash_internal_pointer_reset(xae->call_list);
 		while (zend_hash_get_current_data(xae->call_list, (void**)&xae_call) == SUCCESS) {
-			fprintf(fp, "cfn=%s\n", (*xae_call)->function);
-			fprintf(fp, "calls=%d 0 0\n", (*xae_call)->call_count);
-			fprintf(fp, "%d %lu\n", (*xae_call)->lineno, (unsigned long) ((*xae_call)->time_inclusive * 1000000));
+			xdebug_file_printf(fp, "cfn=%s\n", (*xae_call)->function);
+			xdebug_file_printf(fp, "calls=%d 0 0\n", (*xae_call)->call_count);
+			xdebug_profiler_write_cost_line(fp, (*xae_call)->lineno, &(*xae_call)->cost_inclusive TSRMLS_CC);
 			zend_hash_move_forward(xae->call_list);
 		}
 	}
-	fprintf(fp, "\n");
-	fflush(fp);
+	xdebug_file_printf(fp, "\n");
 
 	return ZEND_HASH_APPLY_KEEP;
 }
 
+static int xdebug_profiler_aggr_shared_vprintf(void *out, const char *fmt, va_list args)
+{
+	return xdebug_file_vprintf((xdebug_file *) out, fmt, args);
+}
+
+static int xdebug_profiler_output_aggr_shared(const char *prefix TSRMLS_DC)
+{
+	char        *filename;
+	xdebug_file *aggr_file;
+	int          ret;
+
+	if (prefix) {
+		filename = xdebug_sprintf("%s/cachegrind.out.aggregate.shared.%s", XG(profiler_output_dir), prefix);
+	} else {
+		filename = xdebug_sprintf("%s/cachegrind.out.aggregate.shared", XG(profiler_output_dir));
+	}
+
+	aggr_file = xdebug_file_open(filename, "w", NULL, NULL, XG(profiler_buffer_size), XDEBUG_OUTPUT_OPTIONS());
+	xdfree(filename);
+	if (!aggr_file) {
+		return FAILURE;
+	}
+	ret = xdebug_aggr_shm_dump(xdebug_aggr_shared, xdebug_profiler_aggr_shared_vprintf, aggr_file);
+	xdebug_file_close(aggr_file);
+
+	return ret == 0 ? SUCCESS : FAILURE;
+}
+
 int xdebug_profiler_output_aggr_data(const char *prefix TSRMLS_DC)
 {
 	char *filename;
-	FILE *aggr_file;
+	xdebug_file *aggr_file;
+
+	if (xdebug_aggr_shared) {
+		return xdebug_profiler_output_aggr_shared(prefix TSRMLS_CC);
+	}
 
 	fprintf(stderr, "in xdebug_profiler_output_aggr_data() with %d entries\n", zend_hash_num_elements(&XG(aggr_calls)));
 
@@ -271,14 +2034,13 @@ int xdebug_profiler_output_aggr_data(const char *prefix TSRMLS_DC)
 	}
 
 	fprintf(stderr, "opening %s\n", filename);
-	aggr_file = xdebug_fopen(filename, "w", NULL, NULL);
+	aggr_file = xdebug_file_open(filename, "w", NULL, NULL, XG(profiler_buffer_size), 0);
 	if (!aggr_file) {
 		return FAILURE;
 	}
-	fprintf(aggr_file, "version: 0.9.6\ncmd: Aggregate\npart: 1\n\nevents: Time\n\n");
-	fflush(aggr_file);
+	xdebug_file_printf(aggr_file, "version: 0.9.6\ncmd: Aggregate\npart: 1\n\nevents: %s\n\n", XDEBUG_PROFILER_EVENTS);
 	zend_hash_apply_with_argument(&XG(aggr_calls), xdebug_print_aggr_entry, aggr_file TSRMLS_CC);
-	fclose(aggr_file);
+	xdebug_file_close(aggr_file);
 	fprintf(stderr, "wrote info for %d entries to %s\n", zend_hash_num_elements(&XG(aggr_calls)), filename);
 	return SUCCESS;
 }
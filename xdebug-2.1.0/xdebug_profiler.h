@@ -23,17 +23,58 @@
 #include "TSRM.h"
 #include "php_xdebug.h"
 #include "xdebug_private.h"
+#include "xdebug_aggregate_shm.h"
+
+/* The aggregate profile shared by all processes, if configured */
+extern xdebug_aggr_shm *xdebug_aggr_shared;
 
 int xdebug_profiler_init(char *script_name TSRMLS_DC);
 void xdebug_profiler_deinit(TSRMLS_D);
+void xdebug_profiler_close_file(TSRMLS_D);
 int xdebug_profiler_output_aggr_data(const char *prefix TSRMLS_DC);
 
+#define XDEBUG_PROFILER_SORT_TIME        0
+#define XDEBUG_PROFILER_SORT_TIME_OWN    1
+#define XDEBUG_PROFILER_SORT_MEMORY      2
+#define XDEBUG_PROFILER_SORT_MEMORY_OWN  3
+#define XDEBUG_PROFILER_SORT_CALLS       4
+
+/* The default xdebug.profiler_categories: the usual suspects for time spent
+ * waiting rather than computing. Patterns match the start of a name, so
+ * "file" covers file_get_contents() and friends too. */
+#define XDEBUG_PROFILER_DEFAULT_CATEGORIES \
+	"db=PDO::*,PDOStatement::*,mysql_*,mysqli_*,mysqli::*,mysqli_stmt::*;" \
+	"file=fopen,fread,fwrite,fgets,fclose,file,readfile,unlink,rename,copy,mkdir,stat,opendir,scandir,glob;" \
+	"session=session_start,session_write_close,session_regenerate_id;" \
+	"lock=flock;" \
+	"network=curl_exec,curl_multi_exec,curl_multi_select,fsockopen,stream_socket_client,stream_select,socket_*,gethostbyname,mail;" \
+	"sleep=sleep,usleep,time_nanosleep"
+
+void xdebug_profiler_get_summary(zval *return_value, long limit, int sort TSRMLS_DC);
+
 void xdebug_profiler_function_user_begin(function_stack_entry *fse TSRMLS_DC);
 void xdebug_profiler_function_user_end(function_stack_entry *fse, zend_op_array *op_array TSRMLS_DC);
+void xdebug_profiler_statement(zend_op_array *op_array, int lineno TSRMLS_DC);
 void xdebug_profiler_function_internal_begin(function_stack_entry *fse TSRMLS_DC);
 void xdebug_profiler_function_internal_end(function_stack_entry *fse TSRMLS_DC);
+int xdebug_profiler_includes_internal(zend_function *zf TSRMLS_DC);
+void xdebug_profiler_compiled(zend_op_array *op_array, xdebug_nanotime time TSRMLS_DC);
+void xdebug_profiler_get_files(zval *return_value TSRMLS_DC);
+void xdebug_profiler_get_categories(zval *return_value TSRMLS_DC);
+void xdebug_profiler_get_sql(zval *return_value TSRMLS_DC);
+void xdebug_profiler_get_repeats(zval *return_value TSRMLS_DC);
+
+int xdebug_profiler_sample_start(TSRMLS_D);
+void xdebug_profiler_sample_stop(TSRMLS_D);
+void xdebug_profiler_sample(TSRMLS_D);
+
+/* Samples are only taken at function entry and exit, the timer just counts
+ * how many are due */
+#define XDEBUG_PROFILER_SAMPLE_CHECK() \
+	if (XG(profile_samples_pending)) { \
+		xdebug_profiler_sample(TSRMLS_C); \
+	}
 
-void xdebug_profile_call_entry_dtor(void *dummy, void *elem);
 void xdebug_profile_aggr_call_entry_dtor(void *elem);
 
 #endif
@@ -260,15 +260,15 @@ void xdebug_append_printable_stack(xdebug_str *str, int html TSRMLS_DC)
 			tmp_name = xdebug_show_fname(i->function, html, 0 TSRMLS_CC);
 			if (html) {
 #if HAVE_PHP_MEMORY_USAGE
-				xdebug_str_add(str, xdebug_sprintf(formats[3], i->level, i->time - XG(start_time), i->memory, tmp_name), 1);
+				xdebug_str_add(str, xdebug_sprintf(formats[3], i->level, XDEBUG_NANOTIME_TO_SECONDS(i->time - XG(start_time)), i->memory, tmp_name), 1);
 #else
-				xdebug_str_add(str, xdebug_sprintf(formats[3], i->level, i->time - XG(start_time), tmp_name), 1);
+				xdebug_str_add(str, xdebug_sprintf(formats[3], i->level, XDEBUG_NANOTIME_TO_SECONDS(i->time - XG(start_time)), tmp_name), 1);
 #endif
 			} else {
 #if HAVE_PHP_MEMORY_USAGE
-				xdebug_str_add(str, xdebug_sprintf(formats[3], i->time - XG(start_time), i->memory, i->level, tmp_name), 1);
+				xdebug_str_add(str, xdebug_sprintf(formats[3], XDEBUG_NANOTIME_TO_SECONDS(i->time - XG(start_time)), i->memory, i->level, tmp_name), 1);
 #else
-				xdebug_str_add(str, xdebug_sprintf(formats[3], i->time - XG(start_time), i->level, tmp_name), 1);
+				xdebug_str_add(str, xdebug_sprintf(formats[3], XDEBUG_NANOTIME_TO_SECONDS(i->time - XG(start_time)), i->level, tmp_name), 1);
 #endif
 			}
 			xdfree(tmp_name);
@@ -593,6 +593,10 @@ void xdebug_error_cb(int type, const char *error_filename, const uint error_line
 # endif
 #endif
 			zend_objects_store_mark_destructed(&EG(objects_store) TSRMLS_CC);
+			/* The frames on the stack are not popped after a bailout */
+			if (XG(profiler_sampling)) {
+				xdebug_profiler_sample_stop(TSRMLS_C);
+			}
 			zend_bailout();
 			return;
 	}
@@ -768,6 +772,115 @@ static void xdebug_build_fname(xdebug_func *tmp, zend_execute_data *edata TSRMLS
 	}
 }
 
+/* Calls made from functions and methods to other functions and methods
+ * have the same aggregate entry for the whole request, as both op_arrays stay
+ * in the function tables. The entry of such a call site is cached by the
+ * address of the callee and of the calling opline, so that its name only
+ * has to be built once. */
+#ifdef ZEND_ACC_CLOSURE
+# define XDEBUG_AGGREGATE_CACHEABLE(zf) ((zf) && (zf)->common.function_name && !((zf)->common.fn_flags & ZEND_ACC_CLOSURE))
+#else
+# define XDEBUG_AGGREGATE_CACHEABLE(zf) ((zf) && (zf)->common.function_name)
+#endif
+
+typedef struct _xdebug_aggregate_site_key {
+	zend_function *callee;
+	zend_op       *opline;
+	int            type;
+} xdebug_aggregate_site_key;
+
+static xdebug_aggregate_site *xdebug_aggregate_get_site(zend_execute_data *edata, function_stack_entry *fse TSRMLS_DC)
+{
+	xdebug_aggregate_site_key  key;
+	xdebug_aggregate_site     *site, new_site;
+	zend_function             *callee;
+
+	if (!edata || !edata->op_array || !edata->opline || !XDEBUG_IS_FUNCTION(fse->function.type)) {
+		return NULL;
+	}
+	callee = fse->user_defined == XDEBUG_EXTERNAL ? (zend_function *) fse->op_array : edata->function_state.function;
+	if (!XDEBUG_AGGREGATE_CACHEABLE(callee) || !XDEBUG_AGGREGATE_CACHEABLE((zend_function *) edata->op_array)) {
+		return NULL;
+	}
+
+	/* The key is hashed as a string, so the padding has to be cleared too */
+	memset(&key, 0, sizeof(key));
+	key.callee = callee;
+	key.opline = edata->opline;
+	key.type = fse->function.type;
+
+	if (!XG(aggr_sites)) {
+		XG(aggr_sites) = xdmalloc(sizeof(HashTable));
+		zend_hash_init(XG(aggr_sites), 256, NULL, NULL, 1);
+	}
+	if (zend_hash_find(XG(aggr_sites), (char *) &key, sizeof(key), (void **) &site) == SUCCESS) {
+		return site;
+	}
+
+	memset(&new_site, 0, sizeof(new_site));
+	zend_hash_add(XG(aggr_sites), (char *) &key, sizeof(key), (void *) &new_site, sizeof(xdebug_aggregate_site), (void **) &site);
+	return site;
+}
+
+static void xdebug_aggregate_find_entry(function_stack_entry *fse TSRMLS_DC)
+{
+	char *func_name = xdebug_show_fname(fse->function, 0, 0 TSRMLS_CC);
+	char *aggr_key;
+	int   aggr_key_len;
+
+	aggr_key = xdebug_sprintf("%s.%s.%d", fse->filename, func_name, fse->lineno);
+	aggr_key_len = strlen(aggr_key);
+
+	if (xdebug_aggr_shared) {
+		char *filename = fse->user_defined == XDEBUG_EXTERNAL ? fse->op_array->filename : "php:internal";
+
+		fse->aggr_slot = xdebug_aggr_shm_entry(xdebug_aggr_shared, aggr_key, aggr_key_len, filename, func_name, fse->lineno);
+		xdfree(func_name);
+	} else if (zend_hash_find(&XG(aggr_calls), aggr_key, aggr_key_len+1, (void**)&fse->aggr_entry) == FAILURE) {
+		xdebug_aggregate_entry xae;
+
+		if (fse->user_defined == XDEBUG_EXTERNAL) {
+			xae.filename = xdstrdup(fse->op_array->filename);
+		} else {
+			xae.filename = xdstrdup("php:internal");
+		}
+		xae.function = func_name;
+		xae.lineno = fse->lineno;
+		xae.user_defined = fse->user_defined;
+		xae.call_count = 0;
+		memset(&xae.cost_own, 0, sizeof(xdebug_profiler_cost));
+		memset(&xae.cost_inclusive, 0, sizeof(xdebug_profiler_cost));
+		xae.call_list = NULL;
+
+		zend_hash_add(&XG(aggr_calls), aggr_key, aggr_key_len+1, (void*)&xae, sizeof(xdebug_aggregate_entry), (void**)&fse->aggr_entry);
+	} else {
+		xdfree(func_name);
+	}
+
+	xdfree(aggr_key);
+}
+
+/* Entries are unique per key, so the callers' lists are keyed by the address
+ * of the callee's entry */
+static void xdebug_aggregate_add_edge(function_stack_entry *prev, function_stack_entry *fse TSRMLS_DC)
+{
+	if (xdebug_aggr_shared) {
+		fse->aggr_edge_slot = xdebug_aggr_shm_edge(xdebug_aggr_shared, prev->aggr_slot, fse->aggr_slot);
+		return;
+	}
+	if (!prev->aggr_entry || !fse->aggr_entry) {
+		return;
+	}
+
+	if (!prev->aggr_entry->call_list) {
+		prev->aggr_entry->call_list = xdmalloc(sizeof(HashTable));
+		zend_hash_init_ex(prev->aggr_entry->call_list, 1, NULL, NULL, 1, 0);
+	}
+	if (!zend_hash_index_exists(prev->aggr_entry->call_list, (ulong) (zend_uintptr_t) fse->aggr_entry)) {
+		zend_hash_index_update(prev->aggr_entry->call_list, (ulong) (zend_uintptr_t) fse->aggr_entry, (void*)&fse->aggr_entry, sizeof(xdebug_aggregate_entry*), NULL);
+	}
+}
+
 function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_array *op_array, int type TSRMLS_DC)
 {
 	zend_execute_data    *edata = EG(current_execute_data);
@@ -775,8 +888,7 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 	zend_op              *cur_opcode;
 	zval                **param;
 	int                   i = 0;
-	char                 *aggr_key;
-	int                   aggr_key_len;
+	xdebug_aggregate_site *site = NULL;
 
 	tmp = xdmalloc (sizeof (function_stack_entry));
 	tmp->var           = NULL;
@@ -788,7 +900,14 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 	tmp->user_defined  = type;
 	tmp->filename      = NULL;
 	tmp->include_filename  = NULL;
-	tmp->profile.call_list = xdebug_llist_alloc(xdebug_profile_call_entry_dtor);
+	tmp->profile.call_list = NULL;
+	tmp->profile.call_list_tail = NULL;
+	tmp->profile.func  = NULL;
+	tmp->profile.stack_node = -1;
+	tmp->profile.line_times = NULL;
+	tmp->aggr_entry    = NULL;
+	tmp->aggr_slot     = 0;
+	tmp->aggr_edge_slot = 0;
 	tmp->op_array      = op_array;
 	tmp->symbol_table  = NULL;
 	tmp->execute_data  = NULL;
@@ -830,7 +949,7 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 	tmp->memory = 0;
 	tmp->prev_memory = 0;
 #endif
-	tmp->time   = xdebug_get_utime();
+	tmp->time   = xdebug_get_nanotime();
 	tmp->lineno = 0;
 
 	xdebug_build_fname(&(tmp->function), zdata TSRMLS_CC);
@@ -949,44 +1068,35 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 		xdebug_count_line(tmp->filename, tmp->lineno, 0, 0 TSRMLS_CC);
 	}
 
-	if (XG(profiler_aggregate)) {
-		char *func_name = xdebug_show_fname(tmp->function, 0, 0 TSRMLS_CC);
-
-		aggr_key = xdebug_sprintf("%s.%s.%d", tmp->filename, func_name, tmp->lineno);
-		aggr_key_len = strlen(aggr_key);
-
-		if (zend_hash_find(&XG(aggr_calls), aggr_key, aggr_key_len+1, (void**)&tmp->aggr_entry) == FAILURE) {
-			xdebug_aggregate_entry xae;
-
-			if (tmp->user_defined == XDEBUG_EXTERNAL) {
-				xae.filename = xdstrdup(tmp->op_array->filename);
-			} else {
-				xae.filename = xdstrdup("php:internal");
+	/* The sampling profiler doesn't time calls, so there is nothing to
+	 * aggregate for them */
+	if (XG(profiler_aggregate) && !XG(profiler_sampling)) {
+		site = xdebug_aggregate_get_site(edata, tmp TSRMLS_CC);
+		if (site && (site->entry || site->slot)) {
+			tmp->aggr_entry = site->entry;
+			tmp->aggr_slot = site->slot;
+		} else {
+			xdebug_aggregate_find_entry(tmp TSRMLS_CC);
+			if (site) {
+				site->entry = tmp->aggr_entry;
+				site->slot = tmp->aggr_slot;
 			}
-			xae.function = func_name;
-			xae.lineno = tmp->lineno;
-			xae.user_defined = tmp->user_defined;
-			xae.call_count = 0;
-			xae.time_own = 0;
-			xae.time_inclusive = 0;
-			xae.call_list = NULL;
-
-			zend_hash_add(&XG(aggr_calls), aggr_key, aggr_key_len+1, (void*)&xae, sizeof(xdebug_aggregate_entry), (void**)&tmp->aggr_entry);
 		}
 	}
 
 	if (XDEBUG_LLIST_TAIL(XG(stack))) {
 		function_stack_entry *prev = XDEBUG_LLIST_VALP(XDEBUG_LLIST_TAIL(XG(stack)));
 		tmp->prev = prev;
-		if (XG(profiler_aggregate)) {
-			if (prev->aggr_entry->call_list) {
-				if (!zend_hash_exists(prev->aggr_entry->call_list, aggr_key, aggr_key_len+1)) {
-					zend_hash_add(prev->aggr_entry->call_list, aggr_key, aggr_key_len+1, (void*)&tmp->aggr_entry, sizeof(xdebug_aggregate_entry*), NULL);
+		if (XG(profiler_aggregate) && !XG(profiler_sampling)) {
+			if (!site || site->edge_caller != prev->aggr_entry || site->edge_caller_slot != prev->aggr_slot) {
+				xdebug_aggregate_add_edge(prev, tmp TSRMLS_CC);
+				if (site) {
+					site->edge_caller = prev->aggr_entry;
+					site->edge_caller_slot = prev->aggr_slot;
+					site->edge_slot = tmp->aggr_edge_slot;
 				}
 			} else {
-				prev->aggr_entry->call_list = xdmalloc(sizeof(HashTable));
-				zend_hash_init_ex(prev->aggr_entry->call_list, 1, NULL, NULL, 1, 0);
-				zend_hash_add(prev->aggr_entry->call_list, aggr_key, aggr_key_len+1, (void*)&tmp->aggr_entry, sizeof(xdebug_aggregate_entry*), NULL);
+				tmp->aggr_edge_slot = site->edge_slot;
 			}
 		}
 	} else {
@@ -994,10 +1104,6 @@ function_stack_entry *xdebug_add_stack_frame(zend_execute_data *zdata, zend_op_a
 	}
 	xdebug_llist_insert_next(XG(stack), XDEBUG_LLIST_TAIL(XG(stack)), tmp);
 
-	if (XG(profiler_aggregate)) {
-		xdfree(aggr_key);
-	}
-
 	return tmp;
 }
 
@@ -30,11 +30,11 @@ void xdebug_trace_function_begin(function_stack_entry *fse, int function_nr TSRM
 {
 	if (XG(do_trace) && XG(trace_file)) {
 		char *t = return_trace_stack_frame_begin(fse, function_nr TSRMLS_CC);
-		if (fprintf(XG(trace_file), "%s", t) < 0) {
-			fclose(XG(trace_file));
+		if (xdebug_file_write(XG(trace_file), t, strlen(t)) < 0) {
+			xdebug_file_close(XG(trace_file));
 			XG(trace_file) = NULL;
 		} else {
-			fflush(XG(trace_file));
+			xdebug_file_flush(XG(trace_file));
 		}
 		xdfree(t);
 	}
@@ -44,11 +44,11 @@ void xdebug_trace_function_end(function_stack_entry *fse, int function_nr TSRMLS
 {
 	if (XG(do_trace) && XG(trace_file)) {
 		char *t = return_trace_stack_frame_end(fse, function_nr TSRMLS_CC);
-		if (fprintf(XG(trace_file), "%s", t) < 0) {
-			fclose(XG(trace_file));
+		if (xdebug_file_write(XG(trace_file), t, strlen(t)) < 0) {
+			xdebug_file_close(XG(trace_file));
 			XG(trace_file) = NULL;
 		} else {
-			fflush(XG(trace_file));
+			xdebug_file_flush(XG(trace_file));
 		}
 		xdfree(t);
 	}
@@ -129,7 +129,7 @@ static char* return_trace_stack_frame_begin_normal(function_stack_entry* i TSRML
 
 	tmp_name = xdebug_show_fname(i->function, 0, 0 TSRMLS_CC);
 
-	xdebug_str_add(&str, xdebug_sprintf("%10.4f ", i->time - XG(start_time)), 1);
+	xdebug_str_add(&str, xdebug_sprintf("%10.4f ", XDEBUG_NANOTIME_TO_SECONDS(i->time - XG(start_time))), 1);
 	xdebug_str_add(&str, xdebug_sprintf("%10lu ", i->memory), 1);
 	if (XG(show_mem_delta)) {
 		xdebug_str_add(&str, xdebug_sprintf("%+8ld ", i->memory - i->prev_memory), 1);
@@ -197,7 +197,7 @@ static char* return_trace_stack_frame_computerized(function_stack_entry* i, int
 		tmp_name = xdebug_show_fname(i->function, 0, 0 TSRMLS_CC);
 
 		xdebug_str_add(&str, "0\t", 0);
-		xdebug_str_add(&str, xdebug_sprintf("%f\t", i->time - XG(start_time)), 1);
+		xdebug_str_add(&str, xdebug_sprintf("%f\t", XDEBUG_NANOTIME_TO_SECONDS(i->time - XG(start_time))), 1);
 #if HAVE_PHP_MEMORY_USAGE
 		xdebug_str_add(&str, xdebug_sprintf("%lu\t", i->memory), 1);
 #else
@@ -254,7 +254,7 @@ static char* return_trace_stack_frame_computerized(function_stack_entry* i, int
 
 	} else if (whence == 1) { /* end */
 		xdebug_str_add(&str, "1\t", 0);
-		xdebug_str_add(&str, xdebug_sprintf("%f\t", xdebug_get_utime() - XG(start_time)), 1);
+		xdebug_str_add(&str, xdebug_sprintf("%f\t", XDEBUG_NANOTIME_TO_SECONDS(xdebug_get_nanotime() - XG(start_time))), 1);
 #if HAVE_PHP_MEMORY_USAGE
 		xdebug_str_add(&str, xdebug_sprintf("%lu\n", XG_MEMORY_USAGE()), 1);
 #else
@@ -273,7 +273,7 @@ static char* return_trace_stack_frame_begin_html(function_stack_entry* i, int fn
 
 	xdebug_str_add(&str, "\t<tr>", 0);
 	xdebug_str_add(&str, xdebug_sprintf("<td>%d</td>", fnr), 1);
-	xdebug_str_add(&str, xdebug_sprintf("<td>%0.6f</td>", i->time - XG(start_time)), 1);
+	xdebug_str_add(&str, xdebug_sprintf("<td>%0.6f</td>", XDEBUG_NANOTIME_TO_SECONDS(i->time - XG(start_time))), 1);
 #if MEMORY_LIMIT
 	xdebug_str_add(&str, xdebug_sprintf("<td align='right'>%lu</td>", i->memory), 1);
 #endif
@@ -370,9 +370,9 @@ char* xdebug_start_trace(char* fname, long options TSRMLS_DC)
 		filename = xdebug_sprintf("%s/%s", XG(trace_output_dir), fname);
 	}
 	if (options & XDEBUG_TRACE_OPTION_APPEND) {
-		XG(trace_file) = xdebug_fopen(filename, "a", "xt", (char**) &tmp_fname);
+		XG(trace_file) = xdebug_file_open(filename, "a", "xt", (char**) &tmp_fname, 0, XDEBUG_OUTPUT_OPTIONS());
 	} else {
-		XG(trace_file) = xdebug_fopen(filename, "w", "xt", (char**) &tmp_fname);
+		XG(trace_file) = xdebug_file_open(filename, "w", "xt", (char**) &tmp_fname, 0, XDEBUG_OUTPUT_OPTIONS());
 	}
 	xdfree(filename);
 	if (options & XDEBUG_TRACE_OPTION_COMPUTERIZED) {
@@ -383,21 +383,21 @@ char* xdebug_start_trace(char* fname, long options TSRMLS_DC)
 	}
 	if (XG(trace_file)) {
 		if (XG(trace_format) == 1) {
-			fprintf(XG(trace_file), "Version: %s\n", XDEBUG_VERSION);
-			fprintf(XG(trace_file), "File format: 2\n");
+			xdebug_file_printf(XG(trace_file), "Version: %s\n", XDEBUG_VERSION);
+			xdebug_file_printf(XG(trace_file), "File format: 2\n");
 		}
 		if (XG(trace_format) == 0 || XG(trace_format) == 1) {
 			str_time = xdebug_get_time();
-			fprintf(XG(trace_file), "TRACE START [%s]\n", str_time);
+			xdebug_file_printf(XG(trace_file), "TRACE START [%s]\n", str_time);
 			xdfree(str_time);
 		}
 		if (XG(trace_format) == 2) {
-			fprintf(XG(trace_file), "<table class='xdebug-trace' dir='ltr' border='1' cellspacing='0'>\n");
-			fprintf(XG(trace_file), "\t<tr><th>#</th><th>Time</th>");
+			xdebug_file_printf(XG(trace_file), "<table class='xdebug-trace' dir='ltr' border='1' cellspacing='0'>\n");
+			xdebug_file_printf(XG(trace_file), "\t<tr><th>#</th><th>Time</th>");
 #if MEMORY_LIMIT
-			fprintf(XG(trace_file), "<th>Mem</th>");
+			xdebug_file_printf(XG(trace_file), "<th>Mem</th>");
 #endif
-			fprintf(XG(trace_file), "<th colspan='2'>Function</th><th>Location</th></tr>\n");
+			xdebug_file_printf(XG(trace_file), "<th colspan='2'>Function</th><th>Location</th></tr>\n");
 		}
 		XG(do_trace) = 1;
 		XG(tracefile_name) = tmp_fname;
@@ -409,28 +409,28 @@ char* xdebug_start_trace(char* fname, long options TSRMLS_DC)
 void xdebug_stop_trace(TSRMLS_D)
 {
 	char   *str_time;
-	double  u_time;
+	xdebug_nanotime u_time;
 
 	XG(do_trace) = 0;
 	if (XG(trace_file)) {
 		if (XG(trace_format) == 0 || XG(trace_format) == 1) {
-			u_time = xdebug_get_utime();
-			fprintf(XG(trace_file), XG(trace_format) == 0 ? "%10.4f " : "\t\t\t%f\t", u_time - XG(start_time));
+			u_time = xdebug_get_nanotime();
+			xdebug_file_printf(XG(trace_file), XG(trace_format) == 0 ? "%10.4f " : "\t\t\t%f\t", XDEBUG_NANOTIME_TO_SECONDS(u_time - XG(start_time)));
 #if HAVE_PHP_MEMORY_USAGE
-			fprintf(XG(trace_file), XG(trace_format) == 0 ? "%10zu" : "%lu", XG_MEMORY_USAGE());
+			xdebug_file_printf(XG(trace_file), XG(trace_format) == 0 ? "%10zu" : "%lu", XG_MEMORY_USAGE());
 #else
-			fprintf(XG(trace_file), XG(trace_format) == 0 ? "%10u" : "", 0);
+			xdebug_file_printf(XG(trace_file), XG(trace_format) == 0 ? "%10u" : "", 0);
 #endif
-			fprintf(XG(trace_file), "\n");
+			xdebug_file_printf(XG(trace_file), "\n");
 			str_time = xdebug_get_time();
-			fprintf(XG(trace_file), "TRACE END   [%s]\n\n", str_time);
+			xdebug_file_printf(XG(trace_file), "TRACE END   [%s]\n\n", str_time);
 			xdfree(str_time);
 		}
 		if (XG(trace_format) == 2) {
-			fprintf(XG(trace_file), "</table>\n");
+			xdebug_file_printf(XG(trace_file), "</table>\n");
 		}
 
-		fclose(XG(trace_file));
+		xdebug_file_close(XG(trace_file));
 		XG(trace_file) = NULL;
 	}
 	if (XG(tracefile_name)) {